@@ -20,11 +20,52 @@
 /* Number of timer ticks since OS booted. */
 static int64_t ticks;
 
+/* 8254 input frequency and the counter value for one tick. */
+#define PIT_HZ 1193180
+#define PIT_TICK_COUNT ((PIT_HZ + TIMER_FREQ / 2) / TIMER_FREQ)
+/* 16비트 카운터로 한 번에 건너뛸 수 있는 최대 tick 수. */
+#define PIT_MAX_ONESHOT_TICKS (0xffff / PIT_TICK_COUNT)
+
+/* If true, the idle thread stops the periodic tick.
+   Controlled by kernel command-line option "-tickless". */
+bool timer_tickless;
+
+/* 틱리스 one-shot 상태. */
+static bool oneshot_armed;          /* PIT가 one-shot 모드인가? */
+static int64_t oneshot_ticks;       /* 프로그램한 tick 수. */
+static uint16_t oneshot_count;      /* 프로그램한 카운터 값. */
+static long long skipped_ticks;     /* 인터럽트 없이 따라잡은 tick 수. */
+static unsigned phase_carry;        /* 아직 tick으로 세지 않은 카운터 값. */
+
 /* Number of loops per timer tick.
    Initialized by timer_calibrate(). */
 static unsigned loops_per_tick;
 
+/* Hierarchical timer wheel.
+   레벨 L의 슬롯 하나는 64^L 틱 구간을 담당한다.  레벨 0 슬롯은 정확히
+   한 틱이고, 레벨 0이 한 바퀴 돌 때마다 레벨 1의 다음 슬롯을 레벨 0으로
+   내려보내는(cascade) 식이다.  4단계면 2^24 틱(100Hz에서 약 46시간)을
+   담을 수 있고, 그보다 먼 이벤트는 마지막 레벨에 머물며 다시 내려온다.
+   wheel_mask[L]의 비트 N은 wheel[L][N]이 비어있지 않음을 뜻한다. */
+#define WHEEL_BITS 6
+#define WHEEL_SIZE (1 << WHEEL_BITS)
+#define WHEEL_MASK (WHEEL_SIZE - 1)
+#define WHEEL_LEVELS 4
+#define WHEEL_SPAN(LEVEL) ((int64_t) 1 << (WHEEL_BITS * (LEVEL)))
+#define WHEEL_INDEX(TICK, LEVEL) \
+	((int) (((TICK) >> (WHEEL_BITS * (LEVEL))) & WHEEL_MASK))
+
+static struct list wheel[WHEEL_LEVELS][WHEEL_SIZE];
+static uint64_t wheel_mask[WHEEL_LEVELS];
+static int64_t wheel_next;      /* 다음에 처리할 tick. */
+
 static intr_handler_func timer_interrupt;
+static void timer_tick (void);
+static void pit_program (int mode, uint16_t count);
+static int64_t wheel_next_expiry (void);
+static void wheel_insert (struct timer_event *);
+static void wheel_cascade (int level, int slot);
+static void wheel_run (int64_t now);
 static bool too_many_loops (unsigned loops);
 static void busy_wait (int64_t loops);
 static void real_time_sleep (int64_t num, int32_t denom);
@@ -36,11 +77,14 @@ void
 timer_init (void) {
 	/* 8254 input frequency divided by TIMER_FREQ, rounded to
 	   nearest. */
-	uint16_t count = (1193180 + TIMER_FREQ / 2) / TIMER_FREQ;
+	pit_program (2, PIT_TICK_COUNT);
 
-	outb (0x43, 0x34);    /* CW: counter 0, LSB then MSB, mode 2, binary. */
-	outb (0x40, count & 0xff);
-	outb (0x40, count >> 8);
+	for (int level = 0; level < WHEEL_LEVELS; level++) {
+		for (int slot = 0; slot < WHEEL_SIZE; slot++)
+			list_init (&wheel[level][slot]);
+		wheel_mask[level] = 0;
+	}
+	wheel_next = 1;
 
 	intr_register_ext (0x20, timer_interrupt, "8254 Timer");
 }
@@ -96,7 +140,7 @@ timer_sleep (int64_t ticks) {
 	//while (timer_elapsed (start) < ticks)
 	//	thread_yield ();
 	if(timer_elapsed(start) < ticks) // 타이머 틱 시작시간보다 ticks가 더 작다면 (당연히 작아야 하는 거 아님?)
-		thread_sleep(start + ticks); // start+ticks 만큼 재운다.
+		thread_sleep(start + ticks); // start+ticks 에 깨어나도록 타이머 휠에 등록하고 재운다.
 }
 
 /* Suspends execution for approximately MS milliseconds. */
@@ -121,24 +165,258 @@ timer_nsleep (int64_t ns) {
 void
 timer_print_stats (void) {
 	printf ("Timer: %"PRId64" ticks\n", timer_ticks ());
+	if (timer_tickless)
+		printf ("Timer: %lld ticks passed without an interrupt\n",
+				skipped_ticks);
+}
+
+/* Called by the idle thread, with interrupts off, right before
+   it halts.  In tickless mode, reprograms the PIT in one-shot
+   mode to fire at the next pending timer event instead of on
+   every tick. */
+void
+timer_tickless_enter (void) {
+	int64_t delta;
+
+	ASSERT (intr_get_level () == INTR_OFF);
+	if (!timer_tickless || oneshot_armed)
+		return;
+
+	/* idle 중에는 time slice가 의미 없으므로 다음 이벤트만 본다. */
+	delta = wheel_next_expiry () - ticks;
+	if (delta <= 1)
+		return;
+	if (delta > PIT_MAX_ONESHOT_TICKS)
+		delta = PIT_MAX_ONESHOT_TICKS;
+
+	oneshot_ticks = delta;
+	oneshot_count = delta * PIT_TICK_COUNT;
+	oneshot_armed = true;
+	pit_program (0, oneshot_count);
+}
+
+/* Called at the start of every external interrupt.  If the idle
+   thread armed a one-shot, catches TICKS up with the time that
+   passed while the timer was silent and restores the periodic
+   tick.
+
+   A one-shot cut short by another device ends part way through
+   a tick.  Reloading the counter restarts the tick phase, so that
+   partial tick is carried over in PHASE_CARRY and counted once
+   the carried parts add up to a whole tick.  TICKS thus lags real
+   time by less than one tick instead of drifting further behind
+   on every wakeup. */
+void
+timer_tickless_exit (void) {
+	uint8_t status;
+	uint16_t count;
+	int64_t elapsed;
+
+	ASSERT (intr_get_level () == INTR_OFF);
+	if (!oneshot_armed)
+		return;
+	oneshot_armed = false;
+
+	/* Read-back: counter 0의 status와 count를 함께 latch. */
+	outb (0x43, 0xc2);
+	status = inb (0x40);
+	count = inb (0x40);
+	count |= inb (0x40) << 8;
+
+	if (status & 0x80) {
+		/* OUT이 올라갔다 = 만료.  마지막 tick은 대기 중인 IRQ0가 센다. */
+		elapsed = oneshot_ticks - 1;
+	} else {
+		unsigned counted = oneshot_count - count + phase_carry;
+
+		elapsed = counted / PIT_TICK_COUNT;
+		phase_carry = counted % PIT_TICK_COUNT;
+	}
+
+	pit_program (2, PIT_TICK_COUNT);
+	skipped_ticks += elapsed;
+	while (elapsed-- > 0)
+		timer_tick ();
 }
 
-/* Timer interrupt handler. */
+/* Initializes timer event EV to call FUNC with AUX when it
+   expires. */
+void
+timer_event_init (struct timer_event *ev, timer_event_func *func, void *aux) {
+	ASSERT (ev != NULL);
+	ASSERT (func != NULL);
+
+	ev->expires = 0;
+	ev->func = func;
+	ev->aux = aux;
+	ev->level = ev->slot = -1;
+}
+
+/* Arms EV to fire at tick EXPIRES.  An expiry that has already
+   passed fires on the next tick.  EV must not be pending.
+
+   This function may be called from an interrupt handler. */
+void
+timer_event_add (struct timer_event *ev, int64_t expires) {
+	enum intr_level old_level;
+
+	ASSERT (ev != NULL);
+	ASSERT (!timer_event_pending (ev));
+
+	old_level = intr_disable ();
+	ev->expires = expires;
+	wheel_insert (ev);
+	intr_set_level (old_level);
+}
+
+/* Disarms EV.  Returns true if EV was pending, false if it had
+   already fired or was never armed. */
+bool
+timer_event_cancel (struct timer_event *ev) {
+	enum intr_level old_level;
+	bool pending;
+
+	ASSERT (ev != NULL);
+
+	old_level = intr_disable ();
+	pending = timer_event_pending (ev);
+	if (pending) {
+		list_remove (&ev->elem);
+		if (list_empty (&wheel[ev->level][ev->slot]))
+			wheel_mask[ev->level] &= ~(1ULL << ev->slot);
+		ev->level = ev->slot = -1;
+	}
+	intr_set_level (old_level);
+	return pending;
+}
+
+/* Returns true if EV is armed and has not fired yet. */
+bool
+timer_event_pending (const struct timer_event *ev) {
+	return ev->level >= 0;
+}
+
+/* EV를 만료 시각에 맞는 휠 슬롯에 넣는다.  인터럽트가 꺼진 상태. */
 static void
-timer_interrupt (struct intr_frame *args UNUSED) {
+wheel_insert (struct timer_event *ev) {
+	int64_t expires = ev->expires < wheel_next ? wheel_next : ev->expires;
+	int64_t delta = expires - wheel_next;
+	int level;
+
+	for (level = 0; level < WHEEL_LEVELS - 1; level++)
+		if (delta < WHEEL_SPAN (level + 1))
+			break;
+	/* 휠 범위를 넘어가면 마지막 레벨의 가장 먼 슬롯에 둔다. */
+	if (delta >= WHEEL_SPAN (WHEEL_LEVELS))
+		expires = wheel_next + WHEEL_SPAN (WHEEL_LEVELS) - 1;
+
+	ev->level = level;
+	ev->slot = WHEEL_INDEX (expires, level);
+	list_push_back (&wheel[level][ev->slot], &ev->elem);
+	wheel_mask[level] |= 1ULL << ev->slot;
+}
+
+/* 상위 레벨 슬롯의 이벤트들을 다시 넣어 아래 레벨로 내려보낸다. */
+static void
+wheel_cascade (int level, int slot) {
+	struct list *bucket = &wheel[level][slot];
+	struct list pending;
+
+	if (!(wheel_mask[level] & (1ULL << slot)))
+		return;
+
+	list_init (&pending);
+	while (!list_empty (bucket))
+		list_push_back (&pending, list_pop_front (bucket));
+	wheel_mask[level] &= ~(1ULL << slot);
+
+	while (!list_empty (&pending)) {
+		struct timer_event *ev =
+			list_entry (list_pop_front (&pending), struct timer_event, elem);
+		wheel_insert (ev);
+	}
+}
+
+/* NOW 까지 밀린 tick을 모두 처리하면서 만료된 이벤트를 실행한다.
+   타이머 인터럽트 컨텍스트에서 호출된다. */
+static void
+wheel_run (int64_t now) {
+	while (wheel_next <= now) {
+		int slot = WHEEL_INDEX (wheel_next, 0);
+		struct list *bucket = &wheel[0][slot];
+
+		/* 레벨 0이 한 바퀴 돌았으면 위 레벨에서 다음 구간을 내려받는다. */
+		for (int level = 1; level < WHEEL_LEVELS; level++) {
+			if (WHEEL_INDEX (wheel_next, level - 1) != 0)
+				break;
+			wheel_cascade (level, WHEEL_INDEX (wheel_next, level));
+		}
+
+		while (!list_empty (bucket)) {
+			struct timer_event *ev =
+				list_entry (list_pop_front (bucket), struct timer_event, elem);
+			ASSERT (ev->expires <= wheel_next);
+			ev->level = ev->slot = -1;
+			ev->func (ev->aux);
+		}
+		wheel_mask[0] &= ~(1ULL << slot);
+		wheel_next++;
+	}
+}
+
+/* 다음 타이머 이벤트를 처리해야 하는 tick을 반환한다.  상위 레벨의
+   이벤트는 정확한 만료 시각 대신 아래로 내려오는(cascade) 시각을
+   반환한다.  이벤트가 없으면 INT64_MAX. */
+static int64_t
+wheel_next_expiry (void) {
+	int64_t next = INT64_MAX;
+
+	for (int level = 0; level < WHEEL_LEVELS; level++) {
+		uint64_t mask = wheel_mask[level];
+		int64_t unit = wheel_next >> (WHEEL_BITS * level);
+		int cur = WHEEL_INDEX (wheel_next, level);
+
+		while (mask != 0) {
+			int slot = __builtin_ctzll (mask);
+			int64_t dist = (slot - cur) & WHEEL_MASK;
+			int64_t when;
+
+			mask &= mask - 1;
+			/* 현재 슬롯은 구간 경계에 막 도달한 경우에만 이번 바퀴에 처리된다. */
+			if (dist == 0 && level > 0
+					&& (wheel_next & (WHEEL_SPAN (level) - 1)) != 0)
+				dist = WHEEL_SIZE;
+			when = (unit + dist) << (WHEEL_BITS * level);
+			if (level == 0)
+				when = wheel_next + dist;
+			if (when < next)
+				next = when;
+		}
+	}
+	return next;
+}
+
+/* Programs PIT counter 0 in MODE with the initial COUNT. */
+static void
+pit_program (int mode, uint16_t count) {
+	/* CW: counter 0, LSB then MSB, MODE, binary. */
+	outb (0x43, 0x30 | (mode << 1));
+	outb (0x40, count & 0xff);
+	outb (0x40, count >> 8);
+}
+
+/* Advances the clock by one tick. */
+static void
+timer_tick (void) {
 	ticks++;
 	thread_tick ();
+	wheel_run (ticks);
+}
 
-	int64_t awake_tick = get_next_tick_to_awake();
-	
-	if (awake_tick <= ticks){ // ==으로 해보기
-		thread_awake(ticks);
-	}
-	/* sleep queue 에서 깨어날 thread가 있는지 확인
-		sleep queue 에서 가장 빨리 깨어날 쓰레드의 tick값 확인
-		있다면 sleep queue를 순회하며 쓰레드 깨움
-			구현하게 될 함수인 thread_awake() 함수 사용
-	*/
+/* Timer interrupt handler. */
+static void
+timer_interrupt (struct intr_frame *args UNUSED) {
+	timer_tick ();
 }
 
 /* Returns true if LOOPS iterations waits for more than one timer
@@ -24,7 +24,9 @@ free_map_init (void) {
  * available. */
 bool
 free_map_allocate (size_t cnt, disk_sector_t *sectorp) {
-	disk_sector_t sector = bitmap_scan_and_flip (free_map, 0, cnt, false);
+	disk_sector_t sector = bitmap_scan_hint (free_map, cnt, false);
+	if (sector != BITMAP_ERROR)
+		bitmap_set_multiple (free_map, sector, cnt, true);
 	if (sector != BITMAP_ERROR
 			&& free_map_file != NULL
 			&& !bitmap_write (free_map, free_map_file)) {
@@ -1,7 +1,9 @@
 #ifndef DEVICES_TIMER_H
 #define DEVICES_TIMER_H
 
+#include <list.h>
 #include <round.h>
+#include <stdbool.h>
 #include <stdint.h>
 
 /* Number of timer interrupts per second. */
@@ -20,4 +22,28 @@ void timer_nsleep (int64_t nanoseconds);
 
 void timer_print_stats (void);
 
+/* Tickless idle.  Controlled by kernel command-line option
+   "-tickless". */
+extern bool timer_tickless;
+void timer_tickless_enter (void);
+void timer_tickless_exit (void);
+
+/* Timer events.
+   EXPIRES 틱에 FUNC(AUX)를 타이머 인터럽트 컨텍스트에서 호출한다.
+   계층형 타이머 휠로 관리되므로 등록/취소는 O(1)이다. */
+typedef void timer_event_func (void *aux);
+
+struct timer_event {
+	int64_t expires;            /* 만료될 tick. */
+	timer_event_func *func;     /* 만료 시 호출할 함수. */
+	void *aux;                  /* FUNC에 넘길 인자. */
+	struct list_elem elem;      /* 타이머 휠 슬롯의 리스트 원소. */
+	int level, slot;            /* 들어있는 휠 위치, 대기중이 아니면 -1. */
+};
+
+void timer_event_init (struct timer_event *, timer_event_func *, void *aux);
+void timer_event_add (struct timer_event *, int64_t expires);
+bool timer_event_cancel (struct timer_event *);
+bool timer_event_pending (const struct timer_event *);
+
 #endif /* devices/timer.h */
@@ -0,0 +1,73 @@
+#ifndef THREADS_FIXED_POINT_H
+#define THREADS_FIXED_POINT_H
+
+#include <stdint.h>
+
+/* 17.14 fixed-point arithmetic for the MLFQS scheduler.
+ *
+ * A fixed-point number is stored in a plain int: the low 14 bits
+ * hold the fraction and the upper 17 bits (plus sign) the integer
+ * part.  See the "4.4BSD Scheduler" appendix of the Pintos manual.
+ * X and Y are fixed-point numbers, N is an integer. */
+
+#define FP_F (1 << 14)                  /* 1.0 in 17.14 format. */
+
+/* 정수 N을 고정소수점으로 */
+static inline int
+int_to_fp (int n) {
+	return n * FP_F;
+}
+
+/* 고정소수점 X를 정수로 (0 방향으로 버림) */
+static inline int
+fp_to_int (int x) {
+	return x / FP_F;
+}
+
+/* 고정소수점 X를 정수로 (반올림) */
+static inline int
+fp_to_int_round (int x) {
+	return x >= 0 ? (x + FP_F / 2) / FP_F : (x - FP_F / 2) / FP_F;
+}
+
+static inline int
+add_fp (int x, int y) {
+	return x + y;
+}
+
+static inline int
+sub_fp (int x, int y) {
+	return x - y;
+}
+
+static inline int
+add_mixed (int x, int n) {
+	return x + n * FP_F;
+}
+
+static inline int
+sub_mixed (int x, int n) {
+	return x - n * FP_F;
+}
+
+static inline int
+mult_fp (int x, int y) {
+	return ((int64_t) x) * y / FP_F;
+}
+
+static inline int
+mult_mixed (int x, int n) {
+	return x * n;
+}
+
+static inline int
+div_fp (int x, int y) {
+	return ((int64_t) x) * FP_F / y;
+}
+
+static inline int
+div_mixed (int x, int n) {
+	return x / n;
+}
+
+#endif /* threads/fixed_point.h */
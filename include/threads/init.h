@@ -15,6 +15,11 @@ extern uint64_t *base_pml4;
 /* -q: Power off when kernel tasks complete? */
 extern bool power_off_when_done;
 
+#ifdef USERPROG
+/* -pt-stats: Print each process's page-table pages when it exits? */
+extern bool pt_stats;
+#endif
+
 void power_off (void) NO_RETURN;
 
 #endif /* threads/init.h */
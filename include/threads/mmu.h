@@ -2,19 +2,46 @@
 #define THREAD_MMU_H
 
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 #include "threads/pte.h"
 
 typedef bool pte_for_each_func (uint64_t *pte, void *va, void *aux);
 
+/* A batch of TLB entries of one pml4 to invalidate at once. */
+#define TLB_BATCH_MAX 32
+
+struct tlb_batch {
+	uint64_t *pml4;                     /* Address space. */
+	size_t cnt;                         /* Pages recorded. */
+	uint64_t va[TLB_BATCH_MAX];         /* The first TLB_BATCH_MAX. */
+	uint64_t *freed;                    /* Page tables to free after. */
+};
+
+void tlb_batch_init (struct tlb_batch *, uint64_t *pml4);
+void tlb_batch_flush (struct tlb_batch *);
+
 uint64_t *pml4e_walk (uint64_t *pml4, const uint64_t va, int create);
 uint64_t *pml4_create (void);
 bool pml4_for_each (uint64_t *, pte_for_each_func *, void *);
 void pml4_destroy (uint64_t *pml4);
+size_t pml4_table_pages (uint64_t *pml4);
+void pml4_print_stats (void);
+void pml4_tlb_init (void);
 void pml4_activate (uint64_t *pml4);
 void *pml4_get_page (uint64_t *pml4, const void *upage);
 bool pml4_set_page (uint64_t *pml4, void *upage, void *kpage, bool rw);
-void pml4_clear_page (uint64_t *pml4, void *upage);
+bool pml4_set_huge_page (uint64_t *pml4, void *upage, void *kpage, bool rw);
+bool pml4_split_huge_page (uint64_t *pml4, void *upage);
+bool pml4_clear_page (uint64_t *pml4, void *upage);
+void pml4_clear_page_batch (struct tlb_batch *, uint64_t *pml4, void *upage);
+bool pml4_remap_page (uint64_t *pml4, void *upage, void *kpage);
+bool pml4_map_range (uint64_t *pml4, void *upage, void *kpage, size_t cnt,
+		bool rw);
+bool pml4_unmap_range (uint64_t *pml4, void *upage, size_t cnt);
+bool pml4_protect_range (uint64_t *pml4, void *upage, size_t cnt, bool rw);
+bool pml4_map_kernel_page (void *kva, void *kpage);
+void *pml4_unmap_kernel_page (void *kva);
 bool pml4_is_dirty (uint64_t *pml4, const void *upage);
 void pml4_set_dirty (uint64_t *pml4, const void *upage, bool dirty);
 bool pml4_is_accessed (uint64_t *pml4, const void *upage);
@@ -23,6 +50,9 @@ void pml4_set_accessed (uint64_t *pml4, const void *upage, bool accessed);
 #define is_writable(pte) (*(pte) & PTE_W)
 #define is_user_pte(pte) (*(pte) & PTE_U)
 #define is_kern_pte(pte) (!is_user_pte (pte))
+/* For a huge page, walks return its page directory entry.  Bit 7
+   of a 4 kB PTE would be PAT, which Pintos never sets. */
+#define is_huge_pte(pte) (*(pte) & PTE_PS)
 
 #define pte_get_paddr(pte) (pg_round_down(*(pte)))
 
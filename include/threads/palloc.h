@@ -1,6 +1,7 @@
 #ifndef THREADS_PALLOC_H
 #define THREADS_PALLOC_H
 
+#include <stdbool.h>
 #include <stdint.h>
 #include <stddef.h>
 
@@ -19,5 +20,13 @@ void *palloc_get_page (enum palloc_flags);
 void *palloc_get_multiple (enum palloc_flags, size_t page_cnt);
 void palloc_free_page (void *);
 void palloc_free_multiple (void *, size_t page_cnt);
+void *palloc_get_huge_page (enum palloc_flags);
+void palloc_free_huge_page (void *);
+bool palloc_zero_idle (void);
+bool palloc_compact_needed (void);
+void *palloc_compact_target (size_t *cursor);
+size_t palloc_compact_begin (void *block);
+void palloc_compact_end (void *block, bool success);
+void palloc_print_stats (void);
 
 #endif /* threads/palloc.h */
@@ -0,0 +1,27 @@
+#ifndef THREADS_RADIX_H
+#define THREADS_RADIX_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/* Radix tree keyed by virtual page, laid out like the x86-64
+   page table.  Lookups take no lock.  See radix.c for details. */
+struct radix_tree {
+	void **root;                /* Top node, or null while empty. */
+	size_t node_cnt;            /* Nodes allocated. */
+	size_t value_cnt;           /* Values stored. */
+};
+
+/* Performs some operation on VALUE, stored at virtual page VA,
+   given auxiliary data AUX.  Returns false to stop iterating. */
+typedef bool radix_action_func (void *va, void *value, void *aux);
+
+void radix_init (struct radix_tree *);
+void *radix_lookup (const struct radix_tree *, const void *va);
+bool radix_insert (struct radix_tree *, const void *va, void *value);
+void *radix_remove (struct radix_tree *, const void *va);
+bool radix_for_each (const struct radix_tree *, const void *start,
+                     const void *end, radix_action_func *, void *aux);
+void radix_destroy (struct radix_tree *, radix_action_func *, void *aux);
+
+#endif /* threads/radix.h */
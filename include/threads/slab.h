@@ -0,0 +1,24 @@
+#ifndef THREADS_SLAB_H
+#define THREADS_SLAB_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/* Object cache.  Hands out objects of one fixed size from
+   page-sized slabs.  See slab.c for details. */
+struct kmem_cache;
+
+/* Optional constructor, run once on every object when its slab
+   is created. */
+typedef void kmem_ctor_func (void *obj);
+
+void kmem_init (void);
+struct kmem_cache *kmem_cache_create (const char *name, size_t size,
+                                      kmem_ctor_func *ctor);
+void *kmem_cache_alloc (struct kmem_cache *);
+void kmem_cache_free (struct kmem_cache *, void *);
+bool kmem_owns (const void *);
+void kmem_free (void *);
+void kmem_print_stats (void);
+
+#endif /* threads/slab.h */
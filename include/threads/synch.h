@@ -3,6 +3,8 @@
 
 #include <list.h>
 #include <stdbool.h>
+#include <stdint.h>
+#include "threads/interrupt.h"
 
 /* A counting semaphore. */
 struct semaphore {
@@ -17,10 +19,25 @@ bool sema_try_down (struct semaphore *);
 void sema_up (struct semaphore *);
 void sema_self_test (void);
 
+/* Priority set.
+   우선순위마다 개수를 세고, 개수가 0이 아닌 우선순위를 mask의 비트로
+   표시한다.  추가/삭제/최댓값 조회가 모두 O(1)이다. */
+#define PRIO_SET_SIZE 64
+struct prio_set {
+	uint64_t mask;                  /* bit N == cnt[N] > 0. */
+	uint16_t cnt[PRIO_SET_SIZE];    /* 우선순위별 개수. */
+};
+
+void prio_set_init (struct prio_set *);
+void prio_set_add (struct prio_set *, int priority);
+void prio_set_remove (struct prio_set *, int priority);
+int prio_set_max (const struct prio_set *);
+
 /* Lock. */
 struct lock {
 	struct thread *holder;      /* Thread holding lock (for debugging). */
 	struct semaphore semaphore; /* Binary semaphore controlling access. */
+	struct prio_set waiters;    /* 기다리는 스레드들의 우선순위. */
 };
 
 void lock_init (struct lock *);
@@ -29,6 +46,39 @@ bool lock_try_acquire (struct lock *);
 void lock_release (struct lock *);
 bool lock_held_by_current_thread (const struct lock *);
 
+/* Reader-writer lock.
+   reader는 여럿이 동시에, writer는 혼자 잡는다.  writer는 내부 lock을
+   쥔 채로 쓰기 때문에 기다리는 스레드들이 writer에게 priority를
+   donation 하고, 기다리던 writer가 있으면 새 reader는 그 뒤에 줄을 선다.
+   (writer preference) */
+struct rwlock {
+	struct lock lock;           /* writer가 보유, reader는 입장할 때만 잠깐. */
+	unsigned readers;           /* 읽고 있는 스레드 수. */
+	bool writer_waiting;        /* reader가 빠지기를 writer가 기다리는 중. */
+	struct semaphore drain;     /* 마지막 reader가 writer를 깨울 때 사용. */
+};
+
+void rwlock_init (struct rwlock *);
+void rwlock_acquire_read (struct rwlock *);
+void rwlock_release_read (struct rwlock *);
+void rwlock_acquire_write (struct rwlock *);
+void rwlock_release_write (struct rwlock *);
+
+/* Ticket spinlock.
+   짧은 임계 구역용.  잠들지 않고 바쁜 대기하며, 번호표 순서(FIFO)로
+   획득한다.  스핀 중 선점되면 안 되므로 인터럽트를 끈 상태에서만 잡는다. */
+struct spinlock {
+	unsigned next;              /* 다음에 발급할 번호표. */
+	unsigned owner;             /* 지금 lock을 가진 번호표. */
+	struct thread *holder;      /* Thread holding lock (for debugging). */
+};
+
+void spinlock_init (struct spinlock *);
+void spin_lock (struct spinlock *);
+void spin_unlock (struct spinlock *);
+enum intr_level spin_lock_irqsave (struct spinlock *);
+void spin_unlock_irqrestore (struct spinlock *, enum intr_level);
+
 /* Condition variable. */
 struct condition {
 	struct list waiters;        /* List of waiting threads. */
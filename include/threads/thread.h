@@ -6,6 +6,7 @@
 #include <stdint.h>
 #include "threads/interrupt.h"
 #include "threads/synch.h" // 이것을 추가해야 포인터를 쓸 수 있습니다.
+#include "devices/timer.h"
 #ifdef VM
 #include "vm/vm.h"
 #endif
@@ -29,6 +30,11 @@ typedef int tid_t;
 #define PRI_DEFAULT 31                  /* Default priority. */
 #define PRI_MAX 63                      /* Highest priority. */
 
+/* Thread niceness (MLFQS). */
+#define NICE_MIN -20                    /* Nicest. */
+#define NICE_DEFAULT 0                  /* Default niceness. */
+#define NICE_MAX 20                     /* Least nice. */
+
 #define FDT_PAGES 2
 #define FDT_COUNT_LIMIT 128
 
@@ -96,14 +102,21 @@ struct thread {
 	char name[16];                      /* Name (for debugging purposes). */
 	int priority;                       /* Priority. */
 	int64_t wakeup_tick;				/* 해당 쓰레드가 깨어나야 할 tick을 저장할 필드 */
+	struct timer_event sleep_event;		/* wakeup_tick에 스레드를 깨우는 타이머 이벤트 */
 	/* Shared between thread.c and synch.c. */
 	struct list_elem elem;              /* List element. */
+	struct list_elem all_elem;          /* List element for all threads list. */
 
 	/*priority donation 관련 항목 추가*/
 	int init_priority;					/* donation 이후 우선순위를 초기화하기 위해 초기값 저장 */
 	struct lock *wait_on_lock;			/* 해당 스레드가 대기 하고 있는 lock자료구조의 주소를 저장 */
-	struct list donations;				/* multiple donation 을 고려하기 위해 사용 */
-	struct list_elem donation_elem;		/* multiple donation 을 고려하기 위해 사용 */
+	struct prio_set held;				/* 보유한 lock마다 그 lock을 기다리는 최고 우선순위 */
+	struct semaphore *wait_on_sema;		/* 대기 중인 semaphore (waiters 재정렬용) */
+
+	/* MLFQS 관련 항목 */
+	int nice;							/* 양보 정도 (NICE_MIN ~ NICE_MAX) */
+	int recent_cpu;						/* 최근 CPU 사용량 (17.14 고정소수점) */
+	int64_t mlfqs_epoch;				/* recent_cpu 감쇠를 마지막으로 적용한 초 */
 
 	/*project 2 - SystemCall 항목 추가*/
 	int exit_status;					/* exit 호출 시 종료 status */
@@ -120,6 +133,8 @@ struct thread {
 
 	struct file *running; // 현재 실행중인 파일
 
+	struct magazine *magazines;			/* 스레드별 malloc() 매거진 (malloc.c) */
+
 #ifdef USERPROG
 	/* Owned by userprog/process.c. */
 	uint64_t *pml4;                     /* Page map level 4 */
@@ -158,6 +173,10 @@ const char *thread_name (void);
 void thread_exit (void) NO_RETURN;
 void thread_yield (void);
 
+/* Performs some operation on thread t, given auxiliary data AUX. */
+typedef void thread_action_func (struct thread *t, void *aux);
+void thread_foreach (thread_action_func *, void *);
+
 int thread_get_priority (void);
 void thread_set_priority (int);
 
@@ -169,9 +188,6 @@ int thread_get_load_avg (void);
 void do_iret (struct intr_frame *tf);
 
 void thread_sleep(int64_t);
-void thread_awake(int64_t);
-void update_next_tick_to_awake(int64_t);
-int64_t get_next_tick_to_awake(void);
 
 void test_max_priority(void);
 bool cmp_priority(const struct list_elem *a, const struct list_elem *b, void *aux UNUSED);
@@ -184,9 +200,6 @@ void donate_priority(void);
 void remove_with_lock(struct lock *lock);
 void refresh_priority(void);
 
-bool
-thread_compare_donate_priority(const struct list_elem *x, const struct list_elem *y, void *aux UNUSED);
-
 void preempt_priority(void);
 
 #endif /* threads/thread.h */
@@ -0,0 +1,17 @@
+#ifndef THREADS_VMALLOC_H
+#define THREADS_VMALLOC_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/* Kernel virtual allocator.  Memory from vmalloc() is virtually
+   but not physically contiguous, so vtop() does not work on it.
+   See vmalloc.c for details. */
+
+void vmalloc_init (void);
+void *vmalloc (size_t size);
+void *vzalloc (size_t size);
+void vfree (void *);
+bool is_vmalloc_addr (const void *);
+
+#endif /* threads/vmalloc.h */
@@ -0,0 +1,9 @@
+#ifndef USERPROG_COMPACT_H
+#define USERPROG_COMPACT_H
+
+#include "threads/synch.h"
+
+void compact_init (void);
+extern struct rwlock migrate_lock;
+
+#endif /* userprog/compact.h */
@@ -16,4 +16,10 @@ int process_add_file(struct file *f);
 struct file *process_get_file(int fd);
 void process_close_file(int fd);
 struct thread *get_child_process(int pid);
+
+#ifdef VM
+struct page;
+size_t segment_read_ahead (struct page **pages, size_t cnt, uint8_t *buf);
+void segment_read_ahead_end (struct page **pages, size_t cnt);
+#endif
 #endif /* userprog/process.h */
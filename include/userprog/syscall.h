@@ -1,7 +1,9 @@
 #ifndef USERPROG_SYSCALL_H
 #define USERPROG_SYSCALL_H
 
+#include "threads/synch.h"
+
 void syscall_init (void);
-struct lock filesys_lock;
+extern struct rwlock filesys_lock;
 
 #endif /* userprog/syscall.h */
\ No newline at end of file
@@ -1,13 +1,16 @@
 #ifndef VM_ANON_H
 #define VM_ANON_H
 #include "vm/vm.h"
+#include "vm/swap.h"
 struct page;
 enum vm_type;
 
 struct anon_page {
+	swap_slot_t slot;       /* 내용이 있는 swap slot, 없으면 SWAP_SLOT_NONE. */
 };
 
 void vm_anon_init (void);
 bool anon_initializer (struct page *page, enum vm_type type, void *kva);
+bool anon_is_zero (struct page *page);
 
 #endif
@@ -0,0 +1,23 @@
+#ifndef VM_EVICT_H
+#define VM_EVICT_H
+
+#include "vm/vm.h"
+
+/* Eviction policy.
+   frame table(vm.c)이 frame_lock을 쥔 채로 부른다.  victim()은
+   pinned가 아닌 frame 하나를 골라 자기 list에서 빼고 돌려주며,
+   고를 것이 없으면 null을 돌려준다. */
+struct evict_policy {
+	const char *name;                   /* -evict= 옵션 값. */
+	void (*init) (void);
+	void (*add) (struct frame *);       /* frame에 page가 올라왔다. */
+	void (*remove) (struct frame *);    /* frame을 해제한다. */
+	struct frame *(*victim) (void);     /* 내보낼 frame. */
+	void (*forget) (uint64_t *pml4);    /* pml4가 사라진다.  없으면 null. */
+};
+
+extern const struct evict_policy evict_clock;
+extern const struct evict_policy evict_2q;
+extern const struct evict_policy evict_arc;
+
+#endif /* vm/evict.h */
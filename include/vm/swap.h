@@ -0,0 +1,26 @@
+#ifndef VM_SWAP_H
+#define VM_SWAP_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+struct disk;
+struct frame;
+
+/* Index of a page-sized slot on the swap disk. */
+typedef size_t swap_slot_t;
+#define SWAP_SLOT_NONE SIZE_MAX
+
+/* 한 번에 묶어서 내보내는 page 수. */
+#define SWAP_CLUSTER 8
+
+void swap_init (struct disk *);
+size_t swap_batch_begin (size_t cnt);
+swap_slot_t swap_queue (struct frame *);
+void swap_batch_submit (void);
+void swap_read (swap_slot_t, void *kva);
+void swap_free (swap_slot_t);
+void swap_print_stats (void);
+
+#endif /* vm/swap.h */
@@ -1,7 +1,10 @@
 #ifndef VM_VM_H
 #define VM_VM_H
+#include <list.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include "threads/palloc.h"
+#include "threads/radix.h"
 
 enum vm_type {
 	/* page not initialized */
@@ -46,6 +49,9 @@ struct page {
 	struct frame *frame;   /* Back reference for frame */
 
 	/* Your implementation */
+	bool writable;         /* 사용자가 쓸 수 있는 page인지. */
+	uint64_t *pml4;        /* frame이 매핑된 page table. */
+	struct list_elem frame_elem;    /* frame->pages의 원소. */
 
 	/* Per-type data are binded into the union.
 	 * Each function automatically detects the current union */
@@ -62,7 +68,18 @@ struct page {
 /* The representation of "frame" */
 struct frame {
 	void *kva;
-	struct page *page;
+	struct page *page;          /* pages의 첫 page. */
+
+	/* fork 뒤에는 여러 page가 copy-on-write로 한 frame을 나눠 쓴다.
+	   frame_lock으로 보호. */
+	struct list pages;          /* 이 frame을 매핑한 page들. */
+	size_t page_cnt;            /* pages의 원소 수 (reference count). */
+
+	/* Eviction policy가 관리한다.  frame_lock으로 보호. */
+	struct list_elem elem;      /* policy의 list 중 하나에 들어간다. */
+	int list;                   /* 어느 list에 있는지 (policy마다 다름). */
+	int pinned;                 /* 0이 아니면 내보내지 않는다. */
+	bool writeback;             /* swap에 쓰는 중.  swap이 갖고 있다. */
 };
 
 /* The function table for page operations.
@@ -81,10 +98,23 @@ struct page_operations {
 #define destroy(page) \
 	if ((page)->operations->destroy) (page)->operations->destroy (page)
 
+/* Fault-around stream.
+   파일에서 읽는 page를 순서대로 훑는 흐름 하나.  다음 fault가 next에서
+   나면 순차 접근으로 보고 window를 키운다. */
+struct fault_stream {
+	void *next;                 /* 순차라면 다음 fault가 날 page. */
+	size_t window;              /* 한 번에 올리는 page 수. */
+};
+
+#define FAULT_STREAMS 4
+
 /* Representation of current process's memory space.
  * We don't want to force you to obey any specific design for this struct.
  * All designs up to you for this. */
 struct supplemental_page_table {
+	struct radix_tree pages;    /* user virtual page -> struct page. */
+	struct fault_stream streams[FAULT_STREAMS];
+	size_t stream_victim;       /* 다음에 바꿀 stream. */
 };
 
 #include "threads/thread.h"
@@ -95,9 +125,13 @@ void supplemental_page_table_kill (struct supplemental_page_table *spt);
 struct page *spt_find_page (struct supplemental_page_table *spt,
 		void *va);
 bool spt_insert_page (struct supplemental_page_table *spt, struct page *page);
-void spt_remove_page (struct supplemental_page_table *spt, struct page *page);
+bool spt_remove_page (struct supplemental_page_table *spt, struct page *page);
 
 void vm_init (void);
+bool vm_set_evict_policy (const char *name);
+void vm_print_stats (void);
+void vm_frame_written (struct frame *);
+bool vm_frame_accessed (struct frame *);
 bool vm_try_handle_fault (struct intr_frame *f, void *addr, bool user,
 		bool write, bool not_present);
 
@@ -3,6 +3,7 @@
 #include <limits.h>
 #include <round.h>
 #include <stdio.h>
+#include <string.h>
 #include "threads/malloc.h"
 #ifdef FILESYS
 #include "filesys/file.h"
@@ -23,10 +24,19 @@ typedef unsigned long elem_type;
 
 /* From the outside, a bitmap is an array of bits.  From the
    inside, it's an array of elem_type (defined above) that
-   simulates an array of bits. */
+   simulates an array of bits.
+
+   On top of the bits sit two summary bitmaps with one bit per
+   element: bit I of HAS_ZERO is set if element I has a false
+   bit, and bit I of HAS_ONE is set if it has a true bit.  Scans
+   use them to jump over whole elements that cannot contain a
+   match, and look at bits one element (64 of them) at a time. */
 struct bitmap {
 	size_t bit_cnt;     /* Number of bits. */
 	elem_type *bits;    /* Elements that represent bits. */
+	elem_type *has_zero; /* Elements that have a false bit. */
+	elem_type *has_one; /* Elements that have a true bit. */
+	size_t hint;        /* Next-fit cursor for bitmap_scan_hint(). */
 };
 
 /* Returns the index of the element that contains the bit
@@ -55,6 +65,20 @@ byte_cnt (size_t bit_cnt) {
 	return sizeof (elem_type) * elem_cnt (bit_cnt);
 }
 
+/* Returns the number of bytes required for one summary of a
+   bitmap with BIT_CNT bits. */
+static inline size_t
+summary_byte_cnt (size_t bit_cnt) {
+	return byte_cnt (elem_cnt (bit_cnt));
+}
+
+/* Returns the number of bytes required for the bits and both
+   summaries of a bitmap with BIT_CNT bits. */
+static inline size_t
+storage_byte_cnt (size_t bit_cnt) {
+	return byte_cnt (bit_cnt) + 2 * summary_byte_cnt (bit_cnt);
+}
+
 /* Returns a bit mask in which the bits actually used in the last
    element of B's bits are set to 1 and the rest are set to 0. */
 static inline elem_type
@@ -62,6 +86,93 @@ last_mask (const struct bitmap *b) {
 	int last_bits = b->bit_cnt % ELEM_BITS;
 	return last_bits ? ((elem_type) 1 << last_bits) - 1 : (elem_type) -1;
 }
+
+/* Returns the number of set bits in E.  (The kernel is not
+   linked against libgcc, so __builtin_popcountl() is out.) */
+static inline size_t
+elem_popcount (elem_type e) {
+	e = e - ((e >> 1) & 0x5555555555555555UL);
+	e = (e & 0x3333333333333333UL) + ((e >> 2) & 0x3333333333333333UL);
+	e = (e + (e >> 4)) & 0x0f0f0f0f0f0f0f0fUL;
+	return (e * 0x0101010101010101UL) >> 56;
+}
+
+/* Returns a mask of the bits of element IDX of B that are
+   actually part of the bitmap. */
+static inline elem_type
+valid_mask (const struct bitmap *b, size_t idx) {
+	return idx == elem_cnt (b->bit_cnt) - 1 ? last_mask (b) : (elem_type) -1;
+}
+
+/* Returns element IDX of B with the bits equal to VALUE set,
+   and all other bits (including those past the end) clear. */
+static inline elem_type
+match_elem (const struct bitmap *b, size_t idx, bool value) {
+	elem_type e = value ? b->bits[idx] : ~b->bits[idx];
+	return e & valid_mask (b, idx);
+}
+
+/* Returns a mask with the CNT bits starting at bit OFS set.
+   OFS + CNT must not exceed ELEM_BITS. */
+static inline elem_type
+range_mask (size_t ofs, size_t cnt) {
+	elem_type m = cnt == ELEM_BITS ? (elem_type) -1 : ((elem_type) 1 << cnt) - 1;
+	return m << ofs;
+}
+
+/* Brings the summary bits for element IDX of B up to date. */
+static void
+summary_update (struct bitmap *b, size_t idx) {
+	elem_type valid = valid_mask (b, idx);
+	elem_type e = b->bits[idx] & valid;
+	elem_type mask = bit_mask (idx);
+
+	if (e != valid)
+		b->has_zero[elem_idx (idx)] |= mask;
+	else
+		b->has_zero[elem_idx (idx)] &= ~mask;
+	if (e != 0)
+		b->has_one[elem_idx (idx)] |= mask;
+	else
+		b->has_one[elem_idx (idx)] &= ~mask;
+}
+
+/* Points B's summaries into the storage that follows its bits,
+   and rebuilds them from the bits. */
+static void
+summary_init (struct bitmap *b) {
+	size_t i;
+
+	b->has_zero = b->bits + elem_cnt (b->bit_cnt);
+	b->has_one = b->has_zero + elem_cnt (elem_cnt (b->bit_cnt));
+	memset (b->has_zero, 0, 2 * summary_byte_cnt (b->bit_cnt));
+	for (i = 0; i < elem_cnt (b->bit_cnt); i++)
+		summary_update (b, i);
+	b->hint = 0;
+}
+
+/* Returns the index of the first element of B at or after IDX
+   that has a bit set to VALUE, according to the summaries, or
+   the number of elements if there is none. */
+static size_t
+next_candidate (const struct bitmap *b, size_t idx, bool value) {
+	const elem_type *summary = value ? b->has_one : b->has_zero;
+	size_t word_cnt = elem_cnt (b->bit_cnt);
+	size_t summary_cnt = elem_cnt (word_cnt);
+	size_t s = elem_idx (idx);
+	elem_type bits;
+
+	if (idx >= word_cnt)
+		return word_cnt;
+	bits = summary[s] & ((elem_type) -1 << (idx % ELEM_BITS));
+	while (bits == 0) {
+		if (++s >= summary_cnt)
+			return word_cnt;
+		bits = summary[s];
+	}
+	idx = s * ELEM_BITS + __builtin_ctzl (bits);
+	return idx < word_cnt ? idx : word_cnt;
+}
 
 /* Creation and destruction. */
 
@@ -74,8 +185,9 @@ bitmap_create (size_t bit_cnt) {
 	struct bitmap *b = malloc (sizeof *b);
 	if (b != NULL) {
 		b->bit_cnt = bit_cnt;
-		b->bits = malloc (byte_cnt (bit_cnt));
+		b->bits = malloc (storage_byte_cnt (bit_cnt));
 		if (b->bits != NULL || bit_cnt == 0) {
+			summary_init (b);
 			bitmap_set_all (b, false);
 			return b;
 		}
@@ -95,6 +207,7 @@ bitmap_create_in_buf (size_t bit_cnt, void *block, size_t block_size UNUSED) {
 
 	b->bit_cnt = bit_cnt;
 	b->bits = (elem_type *) (b + 1);
+	summary_init (b);
 	bitmap_set_all (b, false);
 	return b;
 }
@@ -103,7 +216,7 @@ bitmap_create_in_buf (size_t bit_cnt, void *block, size_t block_size UNUSED) {
    with BIT_CNT bits (for use with bitmap_create_in_buf()). */
 size_t
 bitmap_buf_size (size_t bit_cnt) {
-	return sizeof (struct bitmap) + byte_cnt (bit_cnt);
+	return sizeof (struct bitmap) + storage_byte_cnt (bit_cnt);
 }
 
 /* Destroys bitmap B, freeing its storage.
@@ -148,6 +261,7 @@ bitmap_mark (struct bitmap *b, size_t bit_idx) {
 	   is guaranteed to be atomic on a uniprocessor machine.  See
 	   the description of the OR instruction in [IA32-v2b]. */
 	asm ("lock orq %1, %0" : "=m" (b->bits[idx]) : "r" (mask) : "cc");
+	summary_update (b, idx);
 }
 
 /* Atomically sets the bit numbered BIT_IDX in B to false. */
@@ -160,6 +274,7 @@ bitmap_reset (struct bitmap *b, size_t bit_idx) {
 	   is guaranteed to be atomic on a uniprocessor machine.  See
 	   the description of the AND instruction in [IA32-v2a]. */
 	asm ("lock andq %1, %0" : "=m" (b->bits[idx]) : "r" (~mask) : "cc");
+	summary_update (b, idx);
 }
 
 /* Atomically toggles the bit numbered IDX in B;
@@ -174,6 +289,7 @@ bitmap_flip (struct bitmap *b, size_t bit_idx) {
 	   is guaranteed to be atomic on a uniprocessor machine.  See
 	   the description of the XOR instruction in [IA32-v2b]. */
 	asm ("lock xorq %1, %0" : "=m" (b->bits[idx]) : "r" (mask) : "cc");
+	summary_update (b, idx);
 }
 
 /* Returns the value of the bit numbered IDX in B. */
@@ -194,33 +310,50 @@ bitmap_set_all (struct bitmap *b, bool value) {
 	bitmap_set_multiple (b, 0, bitmap_size (b), value);
 }
 
-/* Sets the CNT bits starting at START in B to VALUE. */
+/* Sets the CNT bits starting at START in B to VALUE.
+   Each element is updated atomically. */
 void
 bitmap_set_multiple (struct bitmap *b, size_t start, size_t cnt, bool value) {
-	size_t i;
-
 	ASSERT (b != NULL);
 	ASSERT (start <= b->bit_cnt);
 	ASSERT (start + cnt <= b->bit_cnt);
 
-	for (i = 0; i < cnt; i++)
-		bitmap_set (b, start + i, value);
+	while (cnt > 0) {
+		size_t idx = elem_idx (start);
+		size_t ofs = start % ELEM_BITS;
+		size_t n = cnt < ELEM_BITS - ofs ? cnt : ELEM_BITS - ofs;
+		elem_type mask = range_mask (ofs, n);
+
+		if (value)
+			__atomic_or_fetch (&b->bits[idx], mask, __ATOMIC_RELAXED);
+		else
+			__atomic_and_fetch (&b->bits[idx], ~mask, __ATOMIC_RELAXED);
+		summary_update (b, idx);
+		start += n;
+		cnt -= n;
+	}
 }
 
 /* Returns the number of bits in B between START and START + CNT,
    exclusive, that are set to VALUE. */
 size_t
 bitmap_count (const struct bitmap *b, size_t start, size_t cnt, bool value) {
-	size_t i, value_cnt;
+	size_t value_cnt;
 
 	ASSERT (b != NULL);
 	ASSERT (start <= b->bit_cnt);
 	ASSERT (start + cnt <= b->bit_cnt);
 
 	value_cnt = 0;
-	for (i = 0; i < cnt; i++)
-		if (bitmap_test (b, start + i) == value)
-			value_cnt++;
+	while (cnt > 0) {
+		size_t ofs = start % ELEM_BITS;
+		size_t n = cnt < ELEM_BITS - ofs ? cnt : ELEM_BITS - ofs;
+
+		value_cnt += elem_popcount (match_elem (b, elem_idx (start), value)
+		                                  & range_mask (ofs, n));
+		start += n;
+		cnt -= n;
+	}
 	return value_cnt;
 }
 
@@ -228,15 +361,19 @@ bitmap_count (const struct bitmap *b, size_t start, size_t cnt, bool value) {
    exclusive, are set to VALUE, and false otherwise. */
 bool
 bitmap_contains (const struct bitmap *b, size_t start, size_t cnt, bool value) {
-	size_t i;
-
 	ASSERT (b != NULL);
 	ASSERT (start <= b->bit_cnt);
 	ASSERT (start + cnt <= b->bit_cnt);
 
-	for (i = 0; i < cnt; i++)
-		if (bitmap_test (b, start + i) == value)
+	while (cnt > 0) {
+		size_t ofs = start % ELEM_BITS;
+		size_t n = cnt < ELEM_BITS - ofs ? cnt : ELEM_BITS - ofs;
+
+		if (match_elem (b, elem_idx (start), value) & range_mask (ofs, n))
 			return true;
+		start += n;
+		cnt -= n;
+	}
 	return false;
 }
 
@@ -266,22 +403,101 @@ bitmap_all (const struct bitmap *b, size_t start, size_t cnt) {
 /* Finds and returns the starting index of the first group of CNT
    consecutive bits in B at or after START that are all set to
    VALUE.
-   If there is no such group, returns BITMAP_ERROR. */
+   If there is no such group, returns BITMAP_ERROR.
+
+   Works one element at a time.  A run may continue from earlier
+   elements into the low bits of the current one, lie entirely
+   inside it, or start in its high bits and continue into later
+   elements.  Elements with no bit set to VALUE are skipped using
+   the summaries. */
 size_t
 bitmap_scan (const struct bitmap *b, size_t start, size_t cnt, bool value) {
+	size_t word_cnt, idx, run_start = 0, run_len = 0;
+
 	ASSERT (b != NULL);
 	ASSERT (start <= b->bit_cnt);
 
-	if (cnt <= b->bit_cnt) {
-		size_t last = b->bit_cnt - cnt;
-		size_t i;
-		for (i = start; i <= last; i++)
-			if (!bitmap_contains (b, i, cnt, !value))
-				return i;
+	if (cnt == 0)
+		return start;
+	if (cnt > b->bit_cnt - start)
+		return BITMAP_ERROR;
+
+	word_cnt = elem_cnt (b->bit_cnt);
+	idx = elem_idx (start);
+	while (idx < word_cnt) {
+		size_t base;
+		elem_type e;
+
+		/* Skip elements that cannot start a run. */
+		if (run_len == 0) {
+			idx = next_candidate (b, idx, value);
+			if (idx >= word_cnt)
+				break;
+		}
+		base = idx * ELEM_BITS;
+		e = match_elem (b, idx, value);
+		if (idx == elem_idx (start))
+			e &= (elem_type) -1 << (start % ELEM_BITS);
+
+		/* Whole element matches: the run goes on. */
+		if (e == (elem_type) -1) {
+			if (run_len == 0)
+				run_start = base;
+			run_len += ELEM_BITS;
+			if (run_len >= cnt)
+				return run_start;
+			idx++;
+			continue;
+		}
+
+		/* Run from earlier elements ending in the low bits. */
+		if (run_len > 0 && run_len + __builtin_ctzl (~e) >= cnt)
+			return run_start;
+
+		/* Run entirely inside this element: AND E with itself
+		   shifted, doubling the length each time, until bit K is
+		   set only where bits K...K+CNT-1 all are. */
+		if (cnt <= ELEM_BITS) {
+			elem_type m = e;
+			size_t len = 1;
+			while (len < cnt && m != 0) {
+				size_t step = len < cnt - len ? len : cnt - len;
+				m &= m >> step;
+				len += step;
+			}
+			if (m != 0)
+				return base + __builtin_ctzl (m);
+		}
+
+		/* Run starting in the high bits, continuing into the next
+		   element. */
+		run_len = __builtin_clzl (~e);
+		run_start = base + ELEM_BITS - run_len;
+		idx++;
 	}
 	return BITMAP_ERROR;
 }
 
+/* Like bitmap_scan(), but next-fit: the search starts where the
+   previous successful bitmap_scan_hint() on B left off, and wraps
+   around to the beginning once. */
+size_t
+bitmap_scan_hint (struct bitmap *b, size_t cnt, bool value) {
+	size_t idx;
+
+	ASSERT (b != NULL);
+
+	idx = bitmap_scan (b, b->hint, cnt, value);
+	if (idx == BITMAP_ERROR && b->hint != 0)
+		idx = bitmap_scan (b, 0, cnt, value);
+	if (idx != BITMAP_ERROR) {
+		b->hint = idx + cnt;
+		if (b->hint >= b->bit_cnt)
+			b->hint = 0;
+	}
+	return idx;
+}
+
 /* Finds the first group of CNT consecutive bits in B at or after
    START that are all set to VALUE, flips them all to !VALUE,
    and returns the index of the first bit in the group.
@@ -315,6 +531,7 @@ bitmap_read (struct bitmap *b, struct file *file) {
 		off_t size = byte_cnt (b->bit_cnt);
 		success = file_read_at (file, b->bits, size, 0) == size;
 		b->bits[elem_cnt (b->bit_cnt) - 1] &= last_mask (b);
+		summary_init (b);
 	}
 	return success;
 }
@@ -0,0 +1,149 @@
+/* Measures the cost of an uncontended acquire/release pair for
+   each of the kernel's mutual exclusion primitives, in TSC
+   cycles.  "lock (old)" is a copy of the lock as it was before
+   the fast path: every acquire and release goes through the
+   semaphore, and every release scans the holder's donation list
+   and recomputes its priority.  "lock" is the current
+   lock_acquire() and lock_release().
+
+   The numbers vary from machine to machine, so only sanity is
+   checked: every primitive must end up released. */
+
+#include <debug.h>
+#include <list.h>
+#include <stdio.h>
+#include "tests/threads/tests.h"
+#include "threads/init.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+
+#define ITERATIONS 100000
+
+/* The old lock.  The donation list used to hang off struct
+   thread, which no longer has one, so the holder's list is kept
+   here.  The benchmark thread holds no other lock, so it is
+   empty, as it was for an uncontended lock. */
+struct old_lock
+  {
+    struct thread *holder;
+    struct semaphore semaphore;
+  };
+
+struct old_donor
+  {
+    struct list_elem elem;
+    struct old_lock *wait_on_lock;
+    int priority;
+  };
+
+static struct list old_donations;
+
+static bool
+old_donor_more (const struct list_elem *a, const struct list_elem *b,
+                void *aux UNUSED)
+{
+  return list_entry (a, struct old_donor, elem)->priority
+         > list_entry (b, struct old_donor, elem)->priority;
+}
+
+static void
+old_lock_acquire (struct old_lock *lock)
+{
+  ASSERT (lock->holder == NULL);
+  sema_down (&lock->semaphore);
+  thread_current ()->wait_on_lock = NULL;
+  lock->holder = thread_current ();
+}
+
+static void
+old_lock_release (struct old_lock *lock)
+{
+  struct thread *cur = thread_current ();
+  struct list_elem *e;
+
+  /* remove_with_lock(). */
+  for (e = list_begin (&old_donations); e != list_end (&old_donations);
+       e = list_next (e))
+    if (list_entry (e, struct old_donor, elem)->wait_on_lock == lock)
+      list_remove (e);
+
+  /* refresh_priority(). */
+  cur->priority = cur->init_priority;
+  if (!list_empty (&old_donations))
+    {
+      struct old_donor *front;
+
+      list_sort (&old_donations, old_donor_more, NULL);
+      front = list_entry (list_front (&old_donations), struct old_donor, elem);
+      if (front->priority > cur->priority)
+        cur->priority = front->priority;
+    }
+
+  lock->holder = NULL;
+  sema_up (&lock->semaphore);
+}
+
+static inline uint64_t
+rdtsc (void)
+{
+  uint32_t lo, hi;
+  asm volatile ("rdtsc" : "=a" (lo), "=d" (hi));
+  return ((uint64_t) hi << 32) | lo;
+}
+
+static void
+report (const char *name, uint64_t cycles)
+{
+  msg ("%s: %llu cycles per acquire/release",
+       name, (unsigned long long) (cycles / ITERATIONS));
+}
+
+void
+test_lock_bench (void)
+{
+  struct spinlock spinlock;
+  struct old_lock old_lock;
+  struct lock lock;
+  uint64_t start;
+  int i;
+
+  /* This test does not work with the MLFQS. */
+  ASSERT (!thread_mlfqs);
+
+  spinlock_init (&spinlock);
+  start = rdtsc ();
+  for (i = 0; i < ITERATIONS; i++)
+    {
+      enum intr_level old_level = spin_lock_irqsave (&spinlock);
+      spin_unlock_irqrestore (&spinlock, old_level);
+    }
+  report ("spinlock", rdtsc () - start);
+  if (spinlock.next != spinlock.owner || spinlock.holder != NULL)
+    fail ("spinlock left held");
+
+  list_init (&old_donations);
+  old_lock.holder = NULL;
+  sema_init (&old_lock.semaphore, 1);
+  start = rdtsc ();
+  for (i = 0; i < ITERATIONS; i++)
+    {
+      old_lock_acquire (&old_lock);
+      old_lock_release (&old_lock);
+    }
+  report ("lock (old)", rdtsc () - start);
+  if (old_lock.holder != NULL || old_lock.semaphore.value != 1)
+    fail ("old lock left held");
+
+  lock_init (&lock);
+  start = rdtsc ();
+  for (i = 0; i < ITERATIONS; i++)
+    {
+      lock_acquire (&lock);
+      lock_release (&lock);
+    }
+  report ("lock", rdtsc () - start);
+  if (lock.holder != NULL || lock.semaphore.value != 1)
+    fail ("lock left held");
+
+  pass ();
+}
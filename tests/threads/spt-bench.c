@@ -0,0 +1,147 @@
+/* Compares the radix tree that backs the supplemental page table
+   with a hash table from lib/kernel/hash.c keyed the same way,
+   in TSC cycles per operation.  Each structure gets PAGE_CNT
+   consecutive pages inserted and looked up, once in address
+   order ("linear") and once in a random order ("shuffle").
+
+   The numbers vary from machine to machine, so only correctness
+   is checked: every lookup must find what was inserted. */
+
+#include <hash.h>
+#include <random.h>
+#include <stdio.h>
+#include "tests/threads/tests.h"
+#include "threads/malloc.h"
+#include "threads/radix.h"
+#include "threads/vaddr.h"
+
+#define PAGE_CNT 4096
+#define BASE ((uint8_t *) 0x400000)
+
+struct entry
+  {
+    struct hash_elem elem;
+    void *va;
+  };
+
+static struct entry *entries;
+static size_t order[PAGE_CNT];
+
+static inline uint64_t
+rdtsc (void)
+{
+  uint32_t lo, hi;
+  asm volatile ("rdtsc" : "=a" (lo), "=d" (hi));
+  return ((uint64_t) hi << 32) | lo;
+}
+
+static uint64_t
+entry_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+  const struct entry *p = hash_entry (e, struct entry, elem);
+  return hash_bytes (&p->va, sizeof p->va);
+}
+
+static bool
+entry_less (const struct hash_elem *a, const struct hash_elem *b,
+            void *aux UNUSED)
+{
+  return hash_entry (a, struct entry, elem)->va
+         < hash_entry (b, struct entry, elem)->va;
+}
+
+static void
+report (const char *name, const char *op, uint64_t cycles)
+{
+  msg ("%s %s: %llu cycles per page",
+       name, op, (unsigned long long) (cycles / PAGE_CNT));
+}
+
+static void
+bench_radix (const char *workload)
+{
+  struct radix_tree tree;
+  uint64_t start;
+  size_t i;
+
+  radix_init (&tree);
+  start = rdtsc ();
+  for (i = 0; i < PAGE_CNT; i++)
+    {
+      struct entry *e = &entries[order[i]];
+      if (!radix_insert (&tree, e->va, e))
+        fail ("radix_insert failed");
+    }
+  report (workload, "radix insert", rdtsc () - start);
+
+  start = rdtsc ();
+  for (i = 0; i < PAGE_CNT; i++)
+    {
+      struct entry *e = &entries[order[i]];
+      if (radix_lookup (&tree, e->va) != e)
+        fail ("radix_lookup returned the wrong value");
+    }
+  report (workload, "radix lookup", rdtsc () - start);
+
+  radix_destroy (&tree, NULL, NULL);
+}
+
+static void
+bench_hash (const char *workload)
+{
+  struct hash hash;
+  uint64_t start;
+  size_t i;
+
+  if (!hash_init (&hash, entry_hash, entry_less, NULL))
+    fail ("hash_init failed");
+  start = rdtsc ();
+  for (i = 0; i < PAGE_CNT; i++)
+    if (hash_insert (&hash, &entries[order[i]].elem) != NULL)
+      fail ("hash_insert found a duplicate");
+  report (workload, "hash insert", rdtsc () - start);
+
+  start = rdtsc ();
+  for (i = 0; i < PAGE_CNT; i++)
+    {
+      struct entry key, *e = &entries[order[i]];
+      key.va = e->va;
+      if (hash_find (&hash, &key.elem) != &e->elem)
+        fail ("hash_find returned the wrong element");
+    }
+  report (workload, "hash lookup", rdtsc () - start);
+
+  hash_destroy (&hash, NULL);
+}
+
+void
+test_spt_bench (void)
+{
+  size_t i;
+
+  entries = malloc (PAGE_CNT * sizeof *entries);
+  if (entries == NULL)
+    fail ("out of memory");
+  for (i = 0; i < PAGE_CNT; i++)
+    {
+      entries[i].va = BASE + i * PGSIZE;
+      order[i] = i;
+    }
+
+  bench_radix ("linear");
+  bench_hash ("linear");
+
+  random_init (0);
+  for (i = PAGE_CNT; i > 1; i--)
+    {
+      size_t j = random_ulong () % i;
+      size_t tmp = order[i - 1];
+      order[i - 1] = order[j];
+      order[j] = tmp;
+    }
+  bench_radix ("shuffle");
+  bench_hash ("shuffle");
+
+  free (entries);
+  pass ();
+}
@@ -20,13 +20,16 @@
 #include "threads/mmu.h"
 #include "threads/palloc.h"
 #include "threads/pte.h"
+#include "threads/slab.h"
 #include "threads/thread.h"
+#include "threads/vmalloc.h"
 #ifdef USERPROG
 #include "userprog/process.h"
 #include "userprog/exception.h"
 #include "userprog/gdt.h"
 #include "userprog/syscall.h"
 #include "userprog/tss.h"
+#include "userprog/compact.h"
 #endif
 #include "tests/threads/tests.h"
 #ifdef VM
@@ -51,6 +54,11 @@ bool power_off_when_done;
 
 bool thread_tests;
 
+#ifdef USERPROG
+/* -pt-stats: Print each process's page-table pages when it exits? */
+bool pt_stats;
+#endif
+
 static void bss_init (void);
 static void paging_init (uint64_t mem_end);
 
@@ -85,7 +93,9 @@ main (void) {
 	/* Initialize memory system. */
 	mem_end = palloc_init ();
 	malloc_init ();
+	kmem_init ();
 	paging_init (mem_end);
+	vmalloc_init ();
 
 #ifdef USERPROG
 	tss_init ();
@@ -115,6 +125,9 @@ main (void) {
 #ifdef VM
 	vm_init ();
 #endif
+#ifdef USERPROG
+	compact_init ();
+#endif
 
 	printf ("Boot complete.\n");
 
@@ -165,6 +178,7 @@ paging_init (uint64_t mem_end) {
 
 	// reload cr3
 	pml4_activate(0);
+	pml4_tlb_init();
 }
 
 /* Breaks the kernel command line into words and returns them as
@@ -221,11 +235,22 @@ parse_options (char **argv) {
 			random_init (atoi (value));
 		else if (!strcmp (name, "-mlfqs"))
 			thread_mlfqs = true;
+		else if (!strcmp (name, "-tickless"))
+			timer_tickless = true;
 #ifdef USERPROG
 		else if (!strcmp (name, "-ul"))
 			user_page_limit = atoi (value);
 		else if (!strcmp (name, "-threads-tests"))
 			thread_tests = true;
+		else if (!strcmp (name, "-pt-stats"))
+			pt_stats = true;
+#endif
+#ifdef VM
+		else if (!strcmp (name, "-evict")) {
+			if (value == NULL || !vm_set_evict_policy (value))
+				PANIC ("unknown eviction policy `%s' (use -h for help)",
+				       value != NULL ? value : "");
+		}
 #endif
 		else
 			PANIC ("unknown option `%s' (use -h for help)", name);
@@ -326,8 +351,13 @@ usage (void) {
 			"  -f                 Format file system disk during startup.\n"
 			"  -rs=SEED           Set random number seed to SEED.\n"
 			"  -mlfqs             Use multi-level feedback queue scheduler.\n"
+			"  -tickless          Stop the periodic timer tick while idle.\n"
 #ifdef USERPROG
 			"  -ul=COUNT          Limit user memory to COUNT pages.\n"
+			"  -pt-stats          Print page-table pages of each exiting process.\n"
+#endif
+#ifdef VM
+			"  -evict=POLICY      Evict frames by POLICY: clock, 2q or arc.\n"
 #endif
 			);
 	power_off ();
@@ -354,6 +384,12 @@ static void
 print_stats (void) {
 	timer_print_stats ();
 	thread_print_stats ();
+	palloc_print_stats ();
+	pml4_print_stats ();
+	kmem_print_stats ();
+#ifdef VM
+	vm_print_stats ();
+#endif
 #ifdef FILESYS
 	disk_print_stats ();
 #endif
@@ -344,6 +344,9 @@ intr_handler (struct intr_frame *frame) {
 
 		in_external_intr = true;
 		yield_on_return = false;
+
+		/* idle 중 멈춰 있던 tick을 먼저 따라잡는다. */
+		timer_tickless_exit ();
 	}
 
 	/* Invoke the interrupt's handler. */
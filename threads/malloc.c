@@ -6,8 +6,11 @@
 #include <stdio.h>
 #include <string.h>
 #include "threads/palloc.h"
+#include "threads/slab.h"
 #include "threads/synch.h"
+#include "threads/thread.h"
 #include "threads/vaddr.h"
+#include "threads/vmalloc.h"
 
 /* A simple implementation of malloc().
 
@@ -32,14 +35,39 @@
    because they're too big to fit in a single page with a
    descriptor.  We handle those by allocating contiguous pages
    with the page allocator and sticking the allocation size at
-   the beginning of the allocated block's arena header. */
+   the beginning of the allocated block's arena header.
+
+   Each thread keeps a "magazine" in front of every descriptor: a
+   small stack of free blocks of that size.  Only the owning
+   thread touches its magazines, so they are used without the
+   descriptor lock and without turning interrupts off.  An empty
+   magazine is refilled, and a full one drained, half a magazine
+   at a time, so code that alternates between malloc() and free()
+   stays inside the magazine.  Blocks sitting in a magazine count
+   as in use from the arena's point of view.  The magazines are
+   allocated on a thread's first malloc() or free() and given
+   back by malloc_thread_exit().  Interrupt handlers bypass them
+   and go to the descriptor directly.
+
+   Each descriptor also holds on to one entirely free arena
+   instead of returning it to the page allocator right away, so a
+   single block that is freed and reallocated does not bounce a
+   page back and forth.  Only a second free arena is released. */
 
 /* Descriptor. */
 struct desc {
 	size_t block_size;          /* Size of each element in bytes. */
 	size_t blocks_per_arena;    /* Number of blocks in an arena. */
 	struct list free_list;      /* List of free blocks. */
-	struct lock lock;           /* Lock. */
+	struct arena *spare;        /* Entirely free arena kept around. */
+	struct spinlock lock;       /* Lock. */
+};
+
+/* Per-thread cache of free blocks for one descriptor. */
+#define MAG_SIZE 16
+struct magazine {
+	size_t cnt;                     /* Number of blocks in ROUNDS. */
+	struct block *rounds[MAG_SIZE]; /* Free blocks, used as a stack. */
 };
 
 /* Magic number for detecting arena corruption. */
@@ -61,8 +89,14 @@ struct block {
 static struct desc descs[10];   /* Descriptors. */
 static size_t desc_cnt;         /* Number of descriptors. */
 
+/* Descriptor that a thread's array of magazines comes from. */
+static struct desc *mag_desc;
+
 static struct arena *block_to_arena (struct block *);
 static struct block *arena_to_block (struct arena *, size_t idx);
+static struct magazine *thread_magazine (struct desc *);
+static size_t desc_get (struct desc *, struct block **, size_t cnt);
+static void desc_put (struct desc *, struct block **, size_t cnt);
 
 /* Initializes the malloc() descriptors. */
 void
@@ -75,8 +109,33 @@ malloc_init (void) {
 		d->block_size = block_size;
 		d->blocks_per_arena = (PGSIZE - sizeof (struct arena)) / block_size;
 		list_init (&d->free_list);
-		lock_init (&d->lock);
+		d->spare = NULL;
+		spinlock_init (&d->lock);
 	}
+
+	/* Find the descriptor for one magazine per descriptor. */
+	for (mag_desc = descs; mag_desc < descs + desc_cnt; mag_desc++)
+		if (mag_desc->block_size >= desc_cnt * sizeof (struct magazine))
+			break;
+	ASSERT (mag_desc < descs + desc_cnt);
+}
+
+/* Returns the current thread's magazines to the descriptors.
+   Called from thread_exit() after the thread's last malloc() or
+   free(). */
+void
+malloc_thread_exit (void) {
+	struct thread *t = thread_current ();
+	struct block *b;
+	size_t i;
+
+	if (t->magazines == NULL)
+		return;
+	for (i = 0; i < desc_cnt; i++)
+		desc_put (&descs[i], t->magazines[i].rounds, t->magazines[i].cnt);
+	b = (struct block *) t->magazines;
+	t->magazines = NULL;
+	desc_put (mag_desc, &b, 1);
 }
 
 /* Obtains and returns a new block of at least SIZE bytes.
@@ -86,6 +145,7 @@ malloc (size_t size) {
 	struct desc *d;
 	struct block *b;
 	struct arena *a;
+	struct magazine *mag;
 
 	/* A null pointer satisfies a request for 0 bytes. */
 	if (size == 0)
@@ -98,9 +158,13 @@ malloc (size_t size) {
 			break;
 	if (d == descs + desc_cnt) {
 		/* SIZE is too big for any descriptor.
-		   Allocate enough pages to hold SIZE plus an arena. */
+		   Allocate enough pages to hold SIZE plus an arena.  If
+		   they are not available contiguously, settle for
+		   virtually contiguous. */
 		size_t page_cnt = DIV_ROUND_UP (size + sizeof *a, PGSIZE);
 		a = palloc_get_multiple (0, page_cnt);
+		if (a == NULL && page_cnt > 1)
+			a = vmalloc (page_cnt * PGSIZE);
 		if (a == NULL)
 			return NULL;
 
@@ -112,35 +176,17 @@ malloc (size_t size) {
 		return a + 1;
 	}
 
-	lock_acquire (&d->lock);
-
-	/* If the free list is empty, create a new arena. */
-	if (list_empty (&d->free_list)) {
-		size_t i;
-
-		/* Allocate a page. */
-		a = palloc_get_page (0);
-		if (a == NULL) {
-			lock_release (&d->lock);
-			return NULL;
-		}
-
-		/* Initialize arena and add its blocks to the free list. */
-		a->magic = ARENA_MAGIC;
-		a->desc = d;
-		a->free_cnt = d->blocks_per_arena;
-		for (i = 0; i < d->blocks_per_arena; i++) {
-			struct block *b = arena_to_block (a, i);
-			list_push_back (&d->free_list, &b->free_elem);
-		}
-	}
-
-	/* Get a block from free list and return it. */
-	b = list_entry (list_pop_front (&d->free_list), struct block, free_elem);
-	a = block_to_arena (b);
-	a->free_cnt--;
-	lock_release (&d->lock);
-	return b;
+	/* Get a block from the thread's magazine, refilling it from
+	   the descriptor if it is empty.  Without a magazine, take
+	   the block from the descriptor directly. */
+	mag = thread_magazine (d);
+	if (mag == NULL)
+		return desc_get (d, &b, 1) > 0 ? b : NULL;
+	if (mag->cnt == 0)
+		mag->cnt = desc_get (d, mag->rounds, MAG_SIZE / 2);
+	if (mag->cnt == 0)
+		return NULL;
+	return mag->rounds[--mag->cnt];
 }
 
 /* Allocates and return A times B bytes initialized to zeroes.
@@ -197,9 +243,14 @@ realloc (void *old_block, size_t new_size) {
 }
 
 /* Frees block P, which must have been previously allocated with
-   malloc(), calloc(), or realloc(). */
+   malloc(), calloc(), or realloc().  Objects from a kmem cache
+   are also accepted and returned to their cache. */
 void
 free (void *p) {
+	if (kmem_owns (p)) {
+		kmem_free (p);
+		return;
+	}
 	if (p != NULL) {
 		struct block *b = p;
 		struct arena *a = block_to_arena (b);
@@ -213,27 +264,25 @@ free (void *p) {
 			memset (b, 0xcc, d->block_size);
 #endif
 
-			lock_acquire (&d->lock);
-
-			/* Add block to free list. */
-			list_push_front (&d->free_list, &b->free_elem);
-
-			/* If the arena is now entirely unused, free it. */
-			if (++a->free_cnt >= d->blocks_per_arena) {
-				size_t i;
+			/* Put the block in the thread's magazine, draining half
+			   of it back to the descriptor first if it is full. */
+			struct magazine *mag = thread_magazine (d);
 
-				ASSERT (a->free_cnt == d->blocks_per_arena);
-				for (i = 0; i < d->blocks_per_arena; i++) {
-					struct block *b = arena_to_block (a, i);
-					list_remove (&b->free_elem);
-				}
-				palloc_free_page (a);
+			if (mag == NULL) {
+				desc_put (d, &b, 1);
+				return;
 			}
-
-			lock_release (&d->lock);
+			if (mag->cnt == MAG_SIZE) {
+				mag->cnt -= MAG_SIZE / 2;
+				desc_put (d, mag->rounds + mag->cnt, MAG_SIZE / 2);
+			}
+			mag->rounds[mag->cnt++] = b;
 		} else {
 			/* It's a big block.  Free its pages. */
-			palloc_free_multiple (a, a->free_cnt);
+			if (is_vmalloc_addr (a))
+				vfree (a);
+			else
+				palloc_free_multiple (a, a->free_cnt);
 			return;
 		}
 	}
@@ -266,3 +315,106 @@ arena_to_block (struct arena *a, size_t idx) {
 			+ sizeof *a
 			+ idx * a->desc->block_size);
 }
+
+/* Returns the current thread's magazine for D, allocating the
+   thread's magazines on first use.  Returns a null pointer in an
+   interrupt handler, which may have interrupted the thread in the
+   middle of using its magazine, or if no memory is available. */
+static struct magazine *
+thread_magazine (struct desc *d) {
+	struct thread *t;
+
+	if (intr_context ())
+		return NULL;
+	t = thread_current ();
+	if (t->magazines == NULL) {
+		struct block *b;
+
+		if (desc_get (mag_desc, &b, 1) == 0)
+			return NULL;
+		memset (b, 0, desc_cnt * sizeof (struct magazine));
+		t->magazines = (struct magazine *) b;
+	}
+	return &t->magazines[d - descs];
+}
+
+/* Takes up to CNT blocks from D's free list and stores them in
+   BLOCKS, creating new arenas as the free list runs dry.  Returns
+   the number of blocks obtained, which is less than CNT only if
+   memory ran out. */
+static size_t
+desc_get (struct desc *d, struct block **blocks, size_t cnt) {
+	enum intr_level old_level;
+	size_t got;
+
+	old_level = spin_lock_irqsave (&d->lock);
+	for (got = 0; got < cnt; got++) {
+		struct block *b;
+		struct arena *a;
+
+		/* If the free list is empty, create a new arena. */
+		if (list_empty (&d->free_list)) {
+			size_t i;
+
+			/* Allocate a page. */
+			a = palloc_get_page (0);
+			if (a == NULL)
+				break;
+
+			/* Initialize arena and add its blocks to the free list. */
+			a->magic = ARENA_MAGIC;
+			a->desc = d;
+			a->free_cnt = d->blocks_per_arena;
+			for (i = 0; i < d->blocks_per_arena; i++) {
+				struct block *b = arena_to_block (a, i);
+				list_push_back (&d->free_list, &b->free_elem);
+			}
+		}
+
+		/* Get a block from free list. */
+		b = list_entry (list_pop_front (&d->free_list), struct block, free_elem);
+		a = block_to_arena (b);
+		if (a == d->spare)
+			d->spare = NULL;
+		a->free_cnt--;
+		blocks[got] = b;
+	}
+	spin_unlock_irqrestore (&d->lock, old_level);
+
+	return got;
+}
+
+/* Returns the CNT blocks in BLOCKS to D's free list.  An arena
+   that becomes entirely free is kept as D's spare; if there
+   already is one, the new one goes back to the page allocator. */
+static void
+desc_put (struct desc *d, struct block **blocks, size_t cnt) {
+	enum intr_level old_level;
+
+	old_level = spin_lock_irqsave (&d->lock);
+	while (cnt-- > 0) {
+		struct block *b = blocks[cnt];
+		struct arena *a = block_to_arena (b);
+
+		/* Add block to free list. */
+		list_push_front (&d->free_list, &b->free_elem);
+
+		/* If the arena is now entirely unused, keep it as the spare
+		   or free it. */
+		if (++a->free_cnt >= d->blocks_per_arena) {
+			size_t i;
+
+			ASSERT (a->free_cnt == d->blocks_per_arena);
+			if (d->spare == NULL) {
+				d->spare = a;
+				continue;
+			}
+			for (i = 0; i < d->blocks_per_arena; i++) {
+				struct block *b = arena_to_block (a, i);
+				list_remove (&b->free_elem);
+			}
+			palloc_free_page (a);
+		}
+	}
+	spin_unlock_irqrestore (&d->lock, old_level);
+}
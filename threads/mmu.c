@@ -1,21 +1,250 @@
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdio.h>
 #include <string.h>
 #include "threads/init.h"
+#include "threads/interrupt.h"
 #include "threads/pte.h"
 #include "threads/palloc.h"
 #include "threads/thread.h"
 #include "threads/mmu.h"
 #include "intrinsic.h"
 
+/* Process-context identifiers (PCIDs).
+
+   With CR4.PCIDE set, the low 12 bits of CR3 tag every TLB entry
+   with the PCID of the address space that created it, so
+   switching address spaces no longer has to flush the TLB.
+
+   A pml4 gets its PCID from its physical page number, direct
+   mapped into 1...PCID_CNT-1; PCID 0 belongs to base_pml4.
+   pcid_owner[] remembers which pml4 last used each PCID.  When
+   another pml4 takes a PCID over, it loads CR3 without the
+   no-flush bit, which drops the stale entries for that PCID
+   only.  Destroying a pml4 frees its PCID the same way, so a new
+   pml4 in the same page cannot see stale entries.
+
+   Changing a PTE of a pml4 that is not active must also reach
+   its PCID's TLB entries.  That uses INVPCID if the CPU has it,
+   and otherwise forgets the owner, so that the next activation
+   flushes.
+
+   There is one table for the whole machine, which is only
+   correct while a single CPU runs user processes. */
+#define PCID_CNT 4096
+#define CR3_NOFLUSH (1ULL << 63)
+#define CR4_PCIDE (1 << 17)
+#define CR4_PGE (1 << 7)
+
+static bool global_enabled;             /* CR4.PGE is set. */
+static bool pcid_enabled;               /* CR4.PCIDE is set. */
+static bool invpcid_enabled;            /* CPU has INVPCID. */
+static uint64_t *pcid_owner[PCID_CNT];  /* pml4 that last used each PCID. */
+
+/* Page-table pages.
+
+   Every level of the page table takes one page from the kernel
+   pool.  Freed ones are zeroed and kept on a small stack, up to
+   PTP_CACHE_MAX, so that the next walk that needs a table does
+   not go through palloc; fork and exit alloc and free tables in
+   bursts.
+
+   A user page table or directory that no longer maps anything
+   after pml4_clear_page() or pml4_unmap_range() is freed right
+   away, together with the directories above it that become
+   empty in turn.  Tables shared with base_pml4 (the kernel's)
+   are never freed this way.
+
+   Like the PCID table, this is one cache for the whole machine,
+   protected by turning interrupts off. */
+#define PTP_CACHE_MAX 32
+
+static void *ptp_cache[PTP_CACHE_MAX];  /* Zeroed free table pages. */
+static size_t ptp_cache_cnt;            /* Entries in ptp_cache. */
+
+/* Statistics. */
+static size_t ptp_live;                 /* Table pages in use. */
+static size_t ptp_peak;                 /* Most in one exiting process
+                                           (-pt-stats only). */
+static unsigned long long ptp_hits;     /* Allocations from the cache. */
+static unsigned long long ptp_misses;   /* Allocations from palloc. */
+static unsigned long long ptp_reclaimed; /* Emptied tables freed early. */
+
+/* Returns a zeroed page for use as a page table, or a null
+   pointer if memory is not available. */
+static uint64_t *
+ptp_alloc (void) {
+	enum intr_level old_level = intr_disable ();
+	void *page = NULL;
+
+	if (ptp_cache_cnt > 0) {
+		page = ptp_cache[--ptp_cache_cnt];
+		ptp_hits++;
+		ptp_live++;
+	}
+	intr_set_level (old_level);
+	if (page != NULL)
+		return page;
+
+	page = palloc_get_page (PAL_ZERO);
+	if (page != NULL) {
+		old_level = intr_disable ();
+		ptp_misses++;
+		ptp_live++;
+		intr_set_level (old_level);
+	}
+	return page;
+}
+
+/* Frees page table PAGE.  Its entries need not be clear. */
+static void
+ptp_free (void *page) {
+	enum intr_level old_level;
+
+	memset (page, 0, PGSIZE);
+	old_level = intr_disable ();
+	ptp_live--;
+	if (ptp_cache_cnt < PTP_CACHE_MAX) {
+		ptp_cache[ptp_cache_cnt++] = page;
+		page = NULL;
+	}
+	intr_set_level (old_level);
+	if (page != NULL)
+		palloc_free_page (page);
+}
+
+/* Returns true if page table TABLE has no present entry. */
+static bool
+table_is_empty (const uint64_t *table) {
+	for (unsigned i = 0; i < PGSIZE / sizeof (uint64_t); i++)
+		if (table[i] & PTE_P)
+			return false;
+	return true;
+}
+
+/* Returns the PCID for PML4. */
+static inline uint64_t
+pml4_pcid (uint64_t *pml4) {
+	return pml4 == base_pml4 ? 0 : pg_no (vtop (pml4)) % (PCID_CNT - 1) + 1;
+}
+
+/* Returns true if PML4 is the active address space. */
+static inline bool
+pml4_is_active (uint64_t *pml4) {
+	return PTE_ADDR (rcr3 ()) == vtop (pml4);
+}
+
+/* Invalidates the TLB entry for VA in PML4, which may or may not
+   be active. */
+static void
+pml4_flush_page (uint64_t *pml4, uint64_t va) {
+	uint64_t pcid;
+
+	if (pml4_is_active (pml4))
+		invlpg (va);
+	else if (pcid_enabled && pcid_owner[pcid = pml4_pcid (pml4)] == pml4) {
+		if (invpcid_enabled)
+			invpcid (0, pcid, va);
+		else
+			pcid_owner[pcid] = NULL;
+	}
+}
+
+/* Replaces the huge page mapped by page directory entry PDE with
+   a page table of 512 4 kB entries that map the same memory with
+   the same flags.  VA is any address in the huge page.  Returns
+   false if memory allocation fails. */
+static bool
+split_huge_pde (uint64_t *pde, const uint64_t va) {
+	uint64_t *pt = ptp_alloc ();
+	uint64_t pa = PTE_ADDR (*pde);
+	uint64_t flags = *pde & PTE_FLAGS & ~PTE_PS;
+
+	if (pt == NULL)
+		return false;
+	for (unsigned i = 0; i < HPG_PAGES; i++)
+		pt[i] = (pa + i * PGSIZE) | flags;
+	*pde = vtop (pt) | PTE_U | PTE_W | PTE_P;
+	/* One invlpg drops the whole 2 MB TLB entry.  Harmless if
+	   another address space is active. */
+	invlpg (va);
+	return true;
+}
+
+/* Invalidates every TLB entry of PML4, which may or may not be
+   active. */
+static void
+pml4_flush_all (uint64_t *pml4) {
+	uint64_t pcid;
+
+	if (pml4_is_active (pml4))
+		/* Reloading CR3 without the no-flush bit drops the
+		   entries of the current PCID (or all, without PCIDs). */
+		lcr3 (vtop (pml4) | (pcid_enabled ? pml4_pcid (pml4) : 0));
+	else if (pcid_enabled && pcid_owner[pcid = pml4_pcid (pml4)] == pml4) {
+		if (invpcid_enabled)
+			invpcid (1, pcid, 0);
+		else
+			pcid_owner[pcid] = NULL;
+	}
+}
+
+static void free_tables (uint64_t *freed);
+
+/* Batched TLB invalidation.
+   Range operations record each page whose present entry they
+   change, and flush once at the end.  Up to TLB_BATCH_MAX pages
+   are invalidated one by one; past that, the whole TLB of the
+   pml4 is flushed, which is cheaper than many INVLPGs.  Page
+   tables emptied on the way are freed only after the flush. */
+
+/* Starts an empty batch for PML4. */
+void
+tlb_batch_init (struct tlb_batch *b, uint64_t *pml4) {
+	b->pml4 = pml4;
+	b->cnt = 0;
+	b->freed = NULL;
+}
+
+/* Records that the entry for VA changed.  For a huge page, any
+   address inside it will do. */
+static void
+tlb_batch_add (struct tlb_batch *b, uint64_t va) {
+	if (b->cnt < TLB_BATCH_MAX)
+		b->va[b->cnt] = va;
+	b->cnt++;
+}
+
+/* Invalidates the entries recorded in B, then frees the page
+   tables it collected.  B is left empty, for the same pml4. */
+void
+tlb_batch_flush (struct tlb_batch *b) {
+	if (b->cnt > TLB_BATCH_MAX)
+		pml4_flush_all (b->pml4);
+	else
+		for (size_t i = 0; i < b->cnt; i++)
+			pml4_flush_page (b->pml4, b->va[i]);
+	b->cnt = 0;
+	free_tables (b->freed);
+	b->freed = NULL;
+}
+
 static uint64_t *
 pgdir_walk (uint64_t *pdp, const uint64_t va, int create) {
 	int idx = PDX (va);
 	if (pdp) {
 		uint64_t *pte = (uint64_t *) pdp[idx];
+		if (((uint64_t) pte & PTE_P) && ((uint64_t) pte & PTE_PS)) {
+			/* Huge page: hand out the PDE itself, unless the caller
+			   wants a 4 kB entry of its own. */
+			if (!create)
+				return &pdp[idx];
+			if (!split_huge_pde (&pdp[idx], va))
+				return NULL;
+		}
 		if (!((uint64_t) pte & PTE_P)) {
 			if (create) {
-				uint64_t *new_page = palloc_get_page (PAL_ZERO);
+				uint64_t *new_page = ptp_alloc ();
 				if (new_page)
 					pdp[idx] = vtop (new_page) | PTE_U | PTE_W | PTE_P;
 				else
@@ -37,7 +266,7 @@ pdpe_walk (uint64_t *pdpe, const uint64_t va, int create) {
 		uint64_t *pde = (uint64_t *) pdpe[idx];
 		if (!((uint64_t) pde & PTE_P)) {
 			if (create) {
-				uint64_t *new_page = palloc_get_page (PAL_ZERO);
+				uint64_t *new_page = ptp_alloc ();
 				if (new_page) {
 					pdpe[idx] = vtop (new_page) | PTE_U | PTE_W | PTE_P;
 					allocated = 1;
@@ -49,7 +278,7 @@ pdpe_walk (uint64_t *pdpe, const uint64_t va, int create) {
 		pte = pgdir_walk (ptov (PTE_ADDR (pdpe[idx])), va, create);
 	}
 	if (pte == NULL && allocated) {
-		palloc_free_page ((void *) ptov (PTE_ADDR (pdpe[idx])));
+		ptp_free (ptov (PTE_ADDR (pdpe[idx])));
 		pdpe[idx] = 0;
 	}
 	return pte;
@@ -60,7 +289,10 @@ pdpe_walk (uint64_t *pdpe, const uint64_t va, int create) {
  * If PML4E does not have a page table for VADDR, behavior depends
  * on CREATE.  If CREATE is true, then a new page table is
  * created and a pointer into it is returned.  Otherwise, a null
- * pointer is returned. */
+ * pointer is returned.
+ * If VADDR is in a huge page, the page directory entry is
+ * returned when CREATE is false.  If CREATE is true, the huge
+ * page is first split into 4 kB pages. */
 uint64_t *
 pml4e_walk (uint64_t *pml4e, const uint64_t va, int create) {
 	uint64_t *pte = NULL;
@@ -70,7 +302,7 @@ pml4e_walk (uint64_t *pml4e, const uint64_t va, int create) {
 		uint64_t *pdpe = (uint64_t *) pml4e[idx];
 		if (!((uint64_t) pdpe & PTE_P)) {
 			if (create) {
-				uint64_t *new_page = palloc_get_page (PAL_ZERO);
+				uint64_t *new_page = ptp_alloc ();
 				if (new_page) {
 					pml4e[idx] = vtop (new_page) | PTE_U | PTE_W | PTE_P;
 					allocated = 1;
@@ -82,19 +314,41 @@ pml4e_walk (uint64_t *pml4e, const uint64_t va, int create) {
 		pte = pdpe_walk (ptov (PTE_ADDR (pml4e[idx])), va, create);
 	}
 	if (pte == NULL && allocated) {
-		palloc_free_page ((void *) ptov (PTE_ADDR (pml4e[idx])));
+		ptp_free (ptov (PTE_ADDR (pml4e[idx])));
 		pml4e[idx] = 0;
 	}
 	return pte;
 }
 
+/* Returns the address of the page directory entry for virtual
+ * address VA in PML4, creating the upper levels if CREATE is
+ * true.  Returns a null pointer if they are missing and CREATE
+ * is false, or if memory allocation fails. */
+static uint64_t *
+pde_walk (uint64_t *pml4, const uint64_t va, bool create) {
+	uint64_t *table = pml4;
+	uint64_t *e;
+
+	for (int level = 0; level < 2; level++) {
+		e = &table[level == 0 ? PML4 (va) : PDPE (va)];
+		if (!(*e & PTE_P)) {
+			uint64_t *new_page;
+			if (!create || (new_page = ptp_alloc ()) == NULL)
+				return NULL;
+			*e = vtop (new_page) | PTE_U | PTE_W | PTE_P;
+		}
+		table = ptov (PTE_ADDR (*e));
+	}
+	return &table[PDX (va)];
+}
+
 /* Creates a new page map level 4 (pml4) has mappings for kernel
  * virtual addresses, but none for user virtual addresses.
  * Returns the new page directory, or a null pointer if memory
  * allocation fails. */
 uint64_t *
 pml4_create (void) {
-	uint64_t *pml4 = palloc_get_page (0);
+	uint64_t *pml4 = ptp_alloc ();
 	if (pml4)
 		memcpy (pml4, base_pml4, PGSIZE);
 	return pml4;
@@ -122,10 +376,18 @@ pgdir_for_each (uint64_t *pdp, pte_for_each_func *func, void *aux,
 		unsigned pml4_index, unsigned pdp_index) {
 	for (unsigned i = 0; i < PGSIZE / sizeof(uint64_t *); i++) {
 		uint64_t *pte = ptov((uint64_t *) pdp[i]);
-		if (((uint64_t) pte) & PTE_P)
-			if (!pt_for_each ((uint64_t *) PTE_ADDR (pte), func, aux,
+		if (((uint64_t) pte) & PTE_P) {
+			if (((uint64_t) pte) & PTE_PS) {
+				/* Huge page: FUNC sees its PDE once. */
+				void *va = (void *) (((uint64_t) pml4_index << PML4SHIFT) |
+									 ((uint64_t) pdp_index << PDPESHIFT) |
+									 ((uint64_t) i << PDXSHIFT));
+				if (!func (&pdp[i], va, aux))
+					return false;
+			} else if (!pt_for_each ((uint64_t *) PTE_ADDR (pte), func, aux,
 					pml4_index, pdp_index, i))
 				return false;
+		}
 	}
 	return true;
 }
@@ -162,17 +424,21 @@ pt_destroy (uint64_t *pt) {
 		if (((uint64_t) pte) & PTE_P)
 			palloc_free_page ((void *) PTE_ADDR (pte));
 	}
-	palloc_free_page ((void *) pt);
+	ptp_free ((void *) pt);
 }
 
 static void
 pgdir_destroy (uint64_t *pdp) {
 	for (unsigned i = 0; i < PGSIZE / sizeof(uint64_t *); i++) {
 		uint64_t *pte = ptov((uint64_t *) pdp[i]);
-		if (((uint64_t) pte) & PTE_P)
-			pt_destroy (PTE_ADDR (pte));
+		if (((uint64_t) pte) & PTE_P) {
+			if (((uint64_t) pte) & PTE_PS)
+				palloc_free_huge_page ((void *) PTE_ADDR (pte));
+			else
+				pt_destroy (PTE_ADDR (pte));
+		}
 	}
-	palloc_free_page ((void *) pdp);
+	ptp_free ((void *) pdp);
 }
 
 static void
@@ -182,7 +448,7 @@ pdpe_destroy (uint64_t *pdpe) {
 		if (((uint64_t) pde) & PTE_P)
 			pgdir_destroy ((void *) PTE_ADDR (pde));
 	}
-	palloc_free_page ((void *) pdpe);
+	ptp_free ((void *) pdpe);
 }
 
 /* Destroys pml4e, freeing all the pages it references. */
@@ -191,19 +457,162 @@ pml4_destroy (uint64_t *pml4) {
 	if (pml4 == NULL)
 		return;
 	ASSERT (pml4 != base_pml4);
+	ASSERT (!pml4_is_active (pml4));
+
+	/* Release the PCID. */
+	if (pcid_enabled) {
+		uint64_t pcid = pml4_pcid (pml4);
+		if (pcid_owner[pcid] == pml4) {
+			if (invpcid_enabled)
+				invpcid (1, pcid, 0);
+			pcid_owner[pcid] = NULL;
+		}
+	}
 
 	/* if PML4 (vaddr) >= 1, it's kernel space by define. */
 	uint64_t *pdpe = ptov ((uint64_t *) pml4[0]);
 	if (((uint64_t) pdpe) & PTE_P)
 		pdpe_destroy ((void *) PTE_ADDR (pdpe));
-	palloc_free_page ((void *) pml4);
+	ptp_free ((void *) pml4);
+}
+
+/* Returns the number of pages PML4's own page tables take,
+ * counting PML4 itself but not the tables it shares with
+ * base_pml4.  With -pt-stats, process_exit() calls this before
+ * it tears the address space down, and the largest result is
+ * kept for pml4_print_stats(). */
+size_t
+pml4_table_pages (uint64_t *pml4) {
+	enum intr_level old_level;
+	size_t cnt = 1;
+
+	for (unsigned i = 0; i < PGSIZE / sizeof (uint64_t); i++) {
+		uint64_t *pdp;
+
+		if (!(pml4[i] & PTE_P) || pml4[i] == base_pml4[i])
+			continue;
+		pdp = ptov (PTE_ADDR (pml4[i]));
+		cnt++;
+		for (unsigned j = 0; j < PGSIZE / sizeof (uint64_t); j++) {
+			uint64_t *pd;
+
+			if (!(pdp[j] & PTE_P))
+				continue;
+			pd = ptov (PTE_ADDR (pdp[j]));
+			cnt++;
+			for (unsigned k = 0; k < PGSIZE / sizeof (uint64_t); k++)
+				if ((pd[k] & PTE_P) && !(pd[k] & PTE_PS))
+					cnt++;
+		}
+	}
+
+	old_level = intr_disable ();
+	if (cnt > ptp_peak)
+		ptp_peak = cnt;
+	intr_set_level (old_level);
+	return cnt;
+}
+
+/* Frees the page table that maps user address VA in PML4 if it
+ * no longer maps anything, then the page directory and the page
+ * directory pointer table above it, as long as they become empty
+ * too.  The freed pages are chained through their first entry
+ * onto *FREED; the caller must flush VA from the TLB before
+ * passing them to free_tables(), because the CPU may still cache
+ * the entries that pointed to them. */
+static void
+reclaim_tables (uint64_t *pml4, uint64_t va, uint64_t **freed) {
+	uint64_t *e[3], *table[3];
+	int level;
+
+	if (pml4[PML4 (va)] == base_pml4[PML4 (va)])
+		return;
+
+	/* 내려갈 수 있는 데까지 내려간다.  huge page는 page table이 아니다. */
+	e[0] = &pml4[PML4 (va)];
+	for (level = 0; level < 3; level++) {
+		if (!(*e[level] & PTE_P) || (*e[level] & PTE_PS))
+			break;
+		table[level] = ptov (PTE_ADDR (*e[level]));
+		if (level < 2)
+			e[level + 1] = &table[level][level == 0 ? PDPE (va) : PDX (va)];
+	}
+
+	/* 아래 단계부터 비어 있는 동안 위로 올라가며 해제한다. */
+	for (level--; level >= 0 && table_is_empty (table[level]); level--) {
+		*e[level] = 0;
+		table[level][0] = (uint64_t) *freed;
+		*freed = table[level];
+		ptp_reclaimed++;
+	}
+}
+
+/* Frees the chain of table pages built by reclaim_tables(). */
+static void
+free_tables (uint64_t *freed) {
+	while (freed != NULL) {
+		uint64_t *next = (uint64_t *) freed[0];
+		ptp_free (freed);
+		freed = next;
+	}
+}
+
+/* Prints page table statistics. */
+void
+pml4_print_stats (void) {
+	printf ("Page tables: %zu pages in use, %zu cached, "
+			"at most %zu in one process at exit; %llu cache hits, %llu misses, "
+			"%llu reclaimed\n",
+			ptp_live, ptp_cache_cnt, ptp_peak, ptp_hits, ptp_misses,
+			ptp_reclaimed);
+}
+
+/* Turns on global pages and PCIDs if the CPU supports them.
+ * Must be called with base_pml4 active. */
+void
+pml4_tlb_init (void) {
+	uint32_t regs[4];
+
+	cpuid (1, 0, regs);
+	if (regs[3] & (1 << 13)) {          /* CPUID.01H:EDX.PGE */
+		lcr4 (rcr4 () | CR4_PGE);
+		global_enabled = true;
+	}
+	if (!(regs[2] & (1 << 17)))         /* CPUID.01H:ECX.PCID */
+		return;
+	cpuid (0, 0, regs);
+	if (regs[0] >= 7) {
+		cpuid (7, 0, regs);
+		invpcid_enabled = regs[1] & (1 << 10); /* CPUID.07H:EBX.INVPCID */
+	}
+
+	ASSERT (rcr3 () == vtop (base_pml4));
+	lcr4 (rcr4 () | CR4_PCIDE);
+	pcid_owner[0] = base_pml4;
+	pcid_enabled = true;
 }
 
 /* Loads page directory PD into the CPU's page directory base
- * register. */
+ * register.  With PCIDs, the TLB is kept unless PD's PCID last
+ * belonged to another pml4. */
 void
 pml4_activate (uint64_t *pml4) {
-	lcr3 (vtop (pml4 ? pml4 : base_pml4));
+	uint64_t pcid;
+
+	if (pml4 == NULL)
+		pml4 = base_pml4;
+	if (!pcid_enabled) {
+		lcr3 (vtop (pml4));
+		return;
+	}
+
+	pcid = pml4_pcid (pml4);
+	if (pcid_owner[pcid] == pml4)
+		lcr3 (vtop (pml4) | pcid | CR3_NOFLUSH);
+	else {
+		pcid_owner[pcid] = pml4;
+		lcr3 (vtop (pml4) | pcid);
+	}
 }
 
 /* Looks up the physical address that corresponds to user virtual
@@ -217,7 +626,8 @@ pml4_get_page (uint64_t *pml4, const void *uaddr) {
 	uint64_t *pte = pml4e_walk (pml4, (uint64_t) uaddr, 0);
 
 	if (pte && (*pte & PTE_P))
-		return ptov (PTE_ADDR (*pte)) + pg_ofs (uaddr);
+		return ptov (PTE_ADDR (*pte))
+			+ (is_huge_pte (pte) ? hpg_ofs (uaddr) : pg_ofs (uaddr));
 	return NULL;
 }
 
@@ -243,25 +653,333 @@ pml4_set_page (uint64_t *pml4, void *upage, void *kpage, bool rw) {
 	return pte != NULL;
 }
 
+/* Adds a mapping in PML4 from the 2 MB user virtual region at
+ * UPAGE to the 2 MB of physical memory at kernel virtual address
+ * KPAGE, as a single huge page.  Both must be aligned to 2 MB in
+ * their own address space; palloc_get_huge_page() returns such
+ * memory.  If WRITABLE is true, the new page is read/write;
+ * otherwise it is read-only.
+ * Returns false if any part of the region already has a page
+ * table or if memory allocation fails. */
+bool
+pml4_set_huge_page (uint64_t *pml4, void *upage, void *kpage, bool rw) {
+	ASSERT (hpg_ofs (upage) == 0);
+	ASSERT (hpg_ofs (vtop (kpage)) == 0);
+	ASSERT (is_user_vaddr (upage));
+	ASSERT (pml4 != base_pml4);
+
+	uint64_t *pde = pde_walk (pml4, (uint64_t) upage, true);
+
+	if (pde == NULL || (*pde & PTE_P))
+		return false;
+	*pde = vtop (kpage) | PTE_P | PTE_PS | (rw ? PTE_W : 0) | PTE_U;
+	return true;
+}
+
+/* If UPAGE lies in a huge page in PML4, replaces it with 512
+ * 4 kB mappings of the same memory, so that parts of it can be
+ * unmapped, protected or replaced on their own.  Returns false
+ * only if memory allocation fails. */
+bool
+pml4_split_huge_page (uint64_t *pml4, void *upage) {
+	uint64_t *pde;
+	ASSERT (is_user_vaddr (upage));
+
+	pde = pde_walk (pml4, (uint64_t) upage, false);
+	if (pde == NULL || (*pde & (PTE_P | PTE_PS)) != (PTE_P | PTE_PS))
+		return true;
+	return split_huge_pde (pde, (uint64_t) upage);
+}
+
+/* Returns the number of pages from VA to the end of its page
+ * table, that is, to the next 2 MB boundary. */
+static inline size_t
+pages_left_in_pt (uint64_t va) {
+	return (HPGSIZE - hpg_ofs (va)) / PGSIZE;
+}
+
+/* Maps the CNT user virtual pages starting at UPAGE in PML4 to
+ * the CNT physically contiguous pages starting at kernel virtual
+ * address KPAGE, read/write if RW is true, read-only otherwise.
+ * Each page table is walked to once, and consecutive entries are
+ * filled in place.
+ * None of the pages may be mapped yet.  Returns false, with the
+ * range left unmapped, if one is or if memory allocation
+ * fails. */
+bool
+pml4_map_range (uint64_t *pml4, void *upage, void *kpage, size_t cnt,
+		bool rw) {
+	uint64_t va = (uint64_t) upage;
+	uint64_t pa = vtop (kpage);
+	size_t done = 0;
+
+	ASSERT (pg_ofs (upage) == 0);
+	ASSERT (pg_ofs (kpage) == 0);
+	ASSERT (is_user_vaddr (upage));
+	ASSERT (pml4 != base_pml4);
+
+	while (done < cnt) {
+		uint64_t *pde = pde_walk (pml4, va, true);
+		uint64_t *pte;
+		size_t left;
+
+		if (pde == NULL || (*pde & PTE_PS))
+			goto fail;
+		if (!(*pde & PTE_P)) {
+			uint64_t *pt = ptp_alloc ();
+			if (pt == NULL)
+				goto fail;
+			*pde = vtop (pt) | PTE_U | PTE_W | PTE_P;
+		}
+
+		pte = (uint64_t *) ptov (PTE_ADDR (*pde)) + PTX (va);
+		for (left = pages_left_in_pt (va); left > 0 && done < cnt; left--) {
+			if (*pte & PTE_P)
+				goto fail;
+			*pte++ = pa | PTE_P | (rw ? PTE_W : 0) | PTE_U;
+			va += PGSIZE;
+			pa += PGSIZE;
+			done++;
+		}
+	}
+	return true;
+
+fail:
+	pml4_unmap_range (pml4, upage, done);
+	return false;
+}
+
+/* Removes the mappings of the CNT user virtual pages starting at
+ * UPAGE in PML4.  Pages that are not mapped are skipped.  Huge
+ * pages inside the range are dropped whole; one that is only
+ * partly inside is split first.  The pages themselves are not
+ * freed.  The TLB is flushed once, at the end.
+ * Returns false if memory allocation fails splitting a huge
+ * page; the part of the range before it is unmapped anyway. */
+bool
+pml4_unmap_range (uint64_t *pml4, void *upage, size_t cnt) {
+	uint64_t va = (uint64_t) upage;
+	uint64_t end = va + cnt * PGSIZE;
+	struct tlb_batch batch;
+	bool success = true;
+
+	ASSERT (pg_ofs (upage) == 0);
+	ASSERT (is_user_vaddr (upage));
+
+	tlb_batch_init (&batch, pml4);
+	while (va < end) {
+		uint64_t *pde = pde_walk (pml4, va, false);
+		size_t left = pages_left_in_pt (va);
+		uint64_t *pte;
+
+		if (pde == NULL || !(*pde & PTE_P)) {
+			va = (end - va) / PGSIZE < left ? end : va + left * PGSIZE;
+			continue;
+		}
+		if (*pde & PTE_PS) {
+			if (hpg_ofs (va) == 0 && end - va >= HPGSIZE) {
+				*pde = 0;
+				tlb_batch_add (&batch, va);
+				reclaim_tables (pml4, va, &batch.freed);
+				va += HPGSIZE;
+				continue;
+			}
+			if (!split_huge_pde (pde, va)) {
+				success = false;
+				break;
+			}
+		}
+
+		pte = (uint64_t *) ptov (PTE_ADDR (*pde)) + PTX (va);
+		for (; left > 0 && va < end; left--, pte++, va += PGSIZE) {
+			if (*pte & PTE_P)
+				tlb_batch_add (&batch, va);
+			*pte = 0;
+		}
+		reclaim_tables (pml4, va - PGSIZE, &batch.freed);
+	}
+	if (batch.freed != NULL)
+		/* Invalidating any address also drops the CPU's cached
+		   upper-level entries, which may point to the freed tables. */
+		tlb_batch_add (&batch, (uint64_t) upage);
+	tlb_batch_flush (&batch);
+	return success;
+}
+
+/* Makes the mapped pages among the CNT user virtual pages
+ * starting at UPAGE in PML4 read/write if RW is true, read-only
+ * otherwise.  Huge pages that are only partly inside the range
+ * are split first.  The TLB is flushed once, at the end.
+ * Returns false if memory allocation fails splitting a huge
+ * page; the part of the range before it is changed anyway. */
+bool
+pml4_protect_range (uint64_t *pml4, void *upage, size_t cnt, bool rw) {
+	uint64_t va = (uint64_t) upage;
+	uint64_t end = va + cnt * PGSIZE;
+	struct tlb_batch batch;
+	bool success = true;
+
+	ASSERT (pg_ofs (upage) == 0);
+	ASSERT (is_user_vaddr (upage));
+
+	tlb_batch_init (&batch, pml4);
+	while (va < end) {
+		uint64_t *pde = pde_walk (pml4, va, false);
+		size_t left = pages_left_in_pt (va);
+		uint64_t *pte;
+
+		if (pde == NULL || !(*pde & PTE_P)) {
+			va = (end - va) / PGSIZE < left ? end : va + left * PGSIZE;
+			continue;
+		}
+		if (*pde & PTE_PS) {
+			if (hpg_ofs (va) == 0 && end - va >= HPGSIZE) {
+				if (!!(*pde & PTE_W) != rw) {
+					*pde ^= PTE_W;
+					tlb_batch_add (&batch, va);
+				}
+				va += HPGSIZE;
+				continue;
+			}
+			if (!split_huge_pde (pde, va)) {
+				success = false;
+				break;
+			}
+		}
+
+		pte = (uint64_t *) ptov (PTE_ADDR (*pde)) + PTX (va);
+		for (; left > 0 && va < end; left--, pte++, va += PGSIZE)
+			if ((*pte & PTE_P) && !!(*pte & PTE_W) != rw) {
+				*pte ^= PTE_W;
+				tlb_batch_add (&batch, va);
+			}
+	}
+	tlb_batch_flush (&batch);
+	return success;
+}
+
+/* Maps kernel virtual page KVA, which lies outside the direct
+ * map, to the page at kernel virtual address KPAGE, read/write,
+ * in every address space.  The mapping goes into base_pml4's
+ * tables; that works for every pml4 only if base_pml4's top-level
+ * entry for KVA existed before any pml4 was created.  The entry
+ * is global if the CPU supports it.  Returns false if memory
+ * allocation fails.  The caller must serialize calls. */
+bool
+pml4_map_kernel_page (void *kva, void *kpage) {
+	uint64_t *pte;
+
+	ASSERT (pg_ofs (kva) == 0);
+	ASSERT (pg_ofs (kpage) == 0);
+	ASSERT (is_kernel_vaddr (kva));
+
+	pte = pml4e_walk (base_pml4, (uint64_t) kva, 1);
+	if (pte == NULL)
+		return false;
+	ASSERT (!(*pte & PTE_P));
+	*pte = vtop (kpage) | PTE_P | PTE_W | (global_enabled ? PTE_G : 0);
+	return true;
+}
+
+/* Removes the mapping of kernel virtual page KVA made by
+ * pml4_map_kernel_page() and invalidates it in every address
+ * space.  Returns the kernel virtual address of the page it
+ * mapped, or a null pointer if KVA was not mapped. */
+void *
+pml4_unmap_kernel_page (void *kva) {
+	uint64_t *pte = pml4e_walk (base_pml4, (uint64_t) kva, 0);
+	void *kpage;
+
+	if (pte == NULL || !(*pte & PTE_P))
+		return NULL;
+	kpage = ptov (PTE_ADDR (*pte));
+	*pte = 0;
+
+	/* INVLPG drops a global entry under every PCID.  Otherwise
+	   the other PCIDs may still cache it. */
+	invlpg ((uint64_t) kva);
+	if (pcid_enabled && !global_enabled) {
+		if (invpcid_enabled)
+			invpcid (2, 0, 0);
+		else
+			memset (pcid_owner, 0, sizeof pcid_owner);
+	}
+	return kpage;
+}
+
 /* Marks user virtual page UPAGE "not present" in page
  * directory PD.  Later accesses to the page will fault.  Other
- * bits in the page table entry are preserved.
- * UPAGE need not be mapped. */
-void
+ * bits in the page table entry are preserved, unless that was
+ * the last present entry in its page table: the page table is
+ * then freed, along with any directories above it left empty.
+ * UPAGE need not be mapped.  A huge page containing UPAGE is
+ * split first; to drop a whole huge page without splitting it,
+ * use pml4_unmap_range().  Returns false, leaving UPAGE mapped,
+ * if memory allocation fails splitting the huge page. */
+bool
 pml4_clear_page (uint64_t *pml4, void *upage) {
+	uint64_t *pte;
+	uint64_t *freed = NULL;
+	ASSERT (pg_ofs (upage) == 0);
+	ASSERT (is_user_vaddr (upage));
+
+	if (!pml4_split_huge_page (pml4, upage))
+		return false;
+	pte = pml4e_walk (pml4, (uint64_t) upage, false);
+
+	if (pte != NULL && (*pte & PTE_P) != 0) {
+		*pte &= ~PTE_P;
+		reclaim_tables (pml4, (uint64_t) upage, &freed);
+		pml4_flush_page (pml4, (uint64_t) upage);
+		free_tables (freed);
+	}
+	return true;
+}
+
+/* Like pml4_clear_page(), but for PML4 the TLB entry is only
+ * recorded in B, to be invalidated by tlb_batch_flush().  If B
+ * belongs to another pml4, it is flushed and restarted for PML4
+ * first.  UPAGE must not lie in a huge page. */
+void
+pml4_clear_page_batch (struct tlb_batch *b, uint64_t *pml4, void *upage) {
 	uint64_t *pte;
 	ASSERT (pg_ofs (upage) == 0);
 	ASSERT (is_user_vaddr (upage));
 
+	if (b->pml4 != pml4) {
+		tlb_batch_flush (b);
+		tlb_batch_init (b, pml4);
+	}
 	pte = pml4e_walk (pml4, (uint64_t) upage, false);
+	ASSERT (pte == NULL || !is_huge_pte (pte));
 
 	if (pte != NULL && (*pte & PTE_P) != 0) {
 		*pte &= ~PTE_P;
-		if (rcr3 () == vtop (pml4))
-			invlpg ((uint64_t) upage);
+		tlb_batch_add (b, (uint64_t) upage);
+		reclaim_tables (pml4, (uint64_t) upage, &b->freed);
 	}
 }
 
+/* Points the mapping of user virtual page UPAGE in PML4 at the
+ * frame at kernel virtual address KPAGE instead, keeping its
+ * permission, accessed and dirty bits.  Used to move a page to
+ * another frame after copying its contents.  Returns false if
+ * UPAGE is not mapped by a 4 kB page. */
+bool
+pml4_remap_page (uint64_t *pml4, void *upage, void *kpage) {
+	ASSERT (pg_ofs (upage) == 0);
+	ASSERT (pg_ofs (kpage) == 0);
+	ASSERT (is_user_vaddr (upage));
+
+	uint64_t *pte = pml4e_walk (pml4, (uint64_t) upage, false);
+
+	if (pte == NULL || (*pte & PTE_P) == 0 || is_huge_pte (pte))
+		return false;
+	*pte = vtop (kpage) | (*pte & PTE_FLAGS);
+	pml4_flush_page (pml4, (uint64_t) upage);
+	return true;
+}
+
 /* Returns true if the PTE for virtual page VPAGE in PML4 is dirty,
  * that is, if the page has been modified since the PTE was
  * installed.
@@ -283,8 +1001,7 @@ pml4_set_dirty (uint64_t *pml4, const void *vpage, bool dirty) {
 		else
 			*pte &= ~(uint32_t) PTE_D;
 
-		if (rcr3 () == vtop (pml4))
-			invlpg ((uint64_t) vpage);
+		pml4_flush_page (pml4, (uint64_t) vpage);
 	}
 }
 
@@ -309,7 +1026,6 @@ pml4_set_accessed (uint64_t *pml4, const void *vpage, bool accessed) {
 		else
 			*pte &= ~(uint32_t) PTE_A;
 
-		if (rcr3 () == vtop (pml4))
-			invlpg ((uint64_t) vpage);
+		pml4_flush_page (pml4, (uint64_t) vpage);
 	}
 }
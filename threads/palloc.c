@@ -2,6 +2,7 @@
 #include <bitmap.h>
 #include <debug.h>
 #include <inttypes.h>
+#include <list.h>
 #include <round.h>
 #include <stddef.h>
 #include <stdint.h>
@@ -9,6 +10,7 @@
 #include <string.h>
 #include "threads/init.h"
 #include "threads/loader.h"
+#include "threads/pte.h"
 #include "threads/synch.h"
 #include "threads/vaddr.h"
 
@@ -24,13 +26,69 @@
 
    By default, half of system RAM is given to the kernel pool and
    half to the user pool.  That should be huge overkill for the
-   kernel pool, but that's just fine for demonstration purposes. */
+   kernel pool, but that's just fine for demonstration purposes.
+
+   Within a pool, free pages are managed by a binary buddy
+   allocator.  Free memory is kept as blocks of 2**K pages, for
+   K up to BUDDY_MAX_ORDER.  Each block is aligned to its own size
+   in physical page numbers and sits on the free list for order K.
+   The list element lives in the first bytes of the free block
+   itself.  An allocation of N pages takes the smallest large
+   enough block, splits off the unused halves, and gives back any
+   pages past N.  A freed block merges with its buddy as long as
+   the buddy is also free, so both operations take O(log n).
+
+   The used_map bitmap still records which pages are in use.  It
+   is used only for sanity checks and for the size of the pool.
+
+   Each pool also keeps a small stack of pages that are already
+   filled with zeros.  The idle thread fills it through
+   palloc_zero_idle(), so a single-page PAL_ZERO request can
+   usually skip the memset().  Pages on the stack count as in use.
+   They go back to the buddy allocator if an allocation would
+   otherwise fail.
+
+   Over time the user pool fragments, so that multi-page
+   allocations fail although many single pages are free.  The
+   compaction daemon (userprog/compact.c) then empties a 2 MB
+   block by moving its user pages elsewhere.  palloc's part is
+   picking the block, keeping its free pages from being handed
+   out meanwhile, and taking the block back whole at the end.
+   Pages of the block freed while it is being emptied stay off
+   the free lists until then. */
+
+/* Largest block the buddy allocator manages: 2**BUDDY_MAX_ORDER
+   pages.  palloc_get_multiple() cannot hand out more at once. */
+#define BUDDY_MAX_ORDER 11
+#define BUDDY_ORDERS (BUDDY_MAX_ORDER + 1)
+
+/* Number of pre-zeroed pages each pool keeps at most. */
+#define ZEROED_MAX 64
 
 /* A memory pool. */
 struct pool {
-	struct lock lock;               /* Mutual exclusion. */
+	struct spinlock lock;           /* Mutual exclusion. */
 	struct bitmap *used_map;        /* Bitmap of free pages. */
 	uint8_t *base;                  /* Base of pool. */
+
+	/* Buddy allocator. */
+	uint8_t *order_map;             /* Per page: order + 1 if the page
+	                                   starts a free block, else 0. */
+	struct list free_list[BUDDY_ORDERS]; /* Free blocks by order. */
+	size_t free_blocks[BUDDY_ORDERS];    /* Length of each free list. */
+	unsigned free_orders;           /* Bit K: free_list[K] nonempty. */
+	size_t free_pages;              /* Total free pages. */
+
+	/* Pre-zeroed pages. */
+	size_t zeroed[ZEROED_MAX];      /* Page indexes, used as a stack. */
+	size_t zeroed_cnt;              /* Number of entries in zeroed. */
+	unsigned long long zeroed_hits; /* PAL_ZERO requests served. */
+
+	/* Compaction. */
+	bool compact_requested;         /* A multi-page request failed. */
+	size_t compacting;              /* First page of the block being
+	                                   emptied, or SIZE_MAX. */
+	unsigned long long compactions; /* Blocks emptied. */
 };
 
 /* Two pools: one for kernel data, one for user pages. */
@@ -42,6 +100,12 @@ static void
 init_pool (struct pool *p, void **bm_base, uint64_t start, uint64_t end);
 
 static bool page_from_pool (const struct pool *, void *page);
+static size_t buddy_alloc (struct pool *, size_t page_cnt);
+static void buddy_free (struct pool *, size_t page_idx, size_t page_cnt);
+static void buddy_remove (struct pool *, size_t page_idx, int order);
+static void free_range (struct pool *, size_t page_idx, size_t page_cnt);
+static void release_zeroed (struct pool *);
+static void print_pool_stats (const char *name, struct pool *);
 
 /* multiboot info */
 struct multiboot_info {
@@ -224,11 +288,13 @@ split:
 			if ((uint64_t) pool_end < end) {
 				page_cnt = ((uint64_t) pool_end - start) / PGSIZE;
 				bitmap_set_multiple (pool->used_map, page_idx, page_cnt, false);
+				buddy_free (pool, page_idx, page_cnt);
 				start = (uint64_t) pool_end;
 				goto split;
 			} else {
 				page_cnt = ((uint64_t) end - start) / PGSIZE;
 				bitmap_set_multiple (pool->used_map, page_idx, page_cnt, false);
+				buddy_free (pool, page_idx, page_cnt);
 			}
 		}
 	}
@@ -263,9 +329,29 @@ void *
 palloc_get_multiple (enum palloc_flags flags, size_t page_cnt) {
 	struct pool *pool = flags & PAL_USER ? &user_pool : &kernel_pool;
 
-	lock_acquire (&pool->lock);
-	size_t page_idx = bitmap_scan_and_flip (pool->used_map, 0, page_cnt, false);
-	lock_release (&pool->lock);
+	if (page_cnt == 0)
+		return NULL;
+
+	enum intr_level old_level = spin_lock_irqsave (&pool->lock);
+	size_t page_idx = BITMAP_ERROR;
+	bool zeroed = false;
+
+	if ((flags & PAL_ZERO) && page_cnt == 1 && pool->zeroed_cnt > 0) {
+		page_idx = pool->zeroed[--pool->zeroed_cnt];
+		pool->zeroed_hits++;
+		zeroed = true;
+	} else {
+		page_idx = buddy_alloc (pool, page_cnt);
+		if (page_idx == BITMAP_ERROR && pool->zeroed_cnt > 0) {
+			release_zeroed (pool);
+			page_idx = buddy_alloc (pool, page_cnt);
+		}
+		if (page_idx != BITMAP_ERROR) {
+			ASSERT (bitmap_none (pool->used_map, page_idx, page_cnt));
+			bitmap_set_multiple (pool->used_map, page_idx, page_cnt, true);
+		}
+	}
+	spin_unlock_irqrestore (&pool->lock, old_level);
 	void *pages;
 
 	if (page_idx != BITMAP_ERROR)
@@ -274,9 +360,11 @@ palloc_get_multiple (enum palloc_flags flags, size_t page_cnt) {
 		pages = NULL;
 
 	if (pages) {
-		if (flags & PAL_ZERO)
+		if ((flags & PAL_ZERO) && !zeroed)
 			memset (pages, 0, PGSIZE * page_cnt);
 	} else {
+		if (page_cnt > 1)
+			pool->compact_requested = true;
 		if (flags & PAL_ASSERT)
 			PANIC ("palloc_get: out of pages");
 	}
@@ -301,6 +389,7 @@ void
 palloc_free_multiple (void *pages, size_t page_cnt) {
 	struct pool *pool;
 	size_t page_idx;
+	enum intr_level old_level;
 
 	ASSERT (pg_ofs (pages) == 0);
 	if (pages == NULL || page_cnt == 0)
@@ -318,8 +407,29 @@ palloc_free_multiple (void *pages, size_t page_cnt) {
 #ifndef NDEBUG
 	memset (pages, 0xcc, PGSIZE * page_cnt);
 #endif
+	old_level = spin_lock_irqsave (&pool->lock);
 	ASSERT (bitmap_all (pool->used_map, page_idx, page_cnt));
 	bitmap_set_multiple (pool->used_map, page_idx, page_cnt, false);
+	free_range (pool, page_idx, page_cnt);
+	spin_unlock_irqrestore (&pool->lock, old_level);
+}
+
+/* Gives the PAGE_CNT pages starting at PAGE_IDX back to POOL's
+   buddy allocator, except those in the block being compacted:
+   palloc_compact_end() takes care of them. */
+static void
+free_range (struct pool *pool, size_t page_idx, size_t page_cnt) {
+	size_t end = page_idx + page_cnt;
+	size_t block = pool->compacting;
+
+	if (block == SIZE_MAX || end <= block || page_idx >= block + HPG_PAGES) {
+		buddy_free (pool, page_idx, page_cnt);
+		return;
+	}
+	if (page_idx < block)
+		buddy_free (pool, page_idx, block - page_idx);
+	if (end > block + HPG_PAGES)
+		buddy_free (pool, block + HPG_PAGES, end - (block + HPG_PAGES));
 }
 
 /* Frees the page at PAGE. */
@@ -328,6 +438,190 @@ palloc_free_page (void *page) {
 	palloc_free_multiple (page, 1);
 }
 
+/* Obtains 2 MB of contiguous memory that is aligned to 2 MB in
+   physical memory, suitable for mapping as one huge page.  FLAGS
+   are as for palloc_get_multiple().  The buddy allocator aligns
+   every block to its size, so this is just an allocation of
+   HPG_PAGES pages. */
+void *
+palloc_get_huge_page (enum palloc_flags flags) {
+	void *pages = palloc_get_multiple (flags, HPG_PAGES);
+
+	ASSERT (pages == NULL || hpg_ofs (vtop (pages)) == 0);
+	return pages;
+}
+
+/* Frees the huge page at PAGES. */
+void
+palloc_free_huge_page (void *pages) {
+	palloc_free_multiple (pages, HPG_PAGES);
+}
+
+/* Returns true if the user pool should be compacted: a
+   multi-page request failed since the last call, or there is no
+   free 2 MB block although enough pages are free to make two. */
+bool
+palloc_compact_needed (void) {
+	struct pool *pool = &user_pool;
+	enum intr_level old_level = spin_lock_irqsave (&pool->lock);
+	bool needed = pool->compact_requested
+		|| ((pool->free_orders >> (PDXSHIFT - PGBITS)) == 0
+			&& pool->free_pages >= 2 * HPG_PAGES);
+
+	pool->compact_requested = false;
+	spin_unlock_irqrestore (&pool->lock, old_level);
+	return needed;
+}
+
+/* Picks the 2 MB block of the user pool that is cheapest to
+   empty: the one with the fewest pages in use, but at least one.
+   The search starts after the block at *CURSOR, which is updated,
+   so that a block that cannot be emptied is not picked again and
+   again.  Returns the block's kernel virtual address, or a null
+   pointer if there is none. */
+void *
+palloc_compact_target (size_t *cursor) {
+	struct pool *pool = &user_pool;
+	size_t page_cnt = bitmap_size (pool->used_map);
+	size_t first = (HPG_PAGES - pg_no (vtop (pool->base)) % HPG_PAGES) % HPG_PAGES;
+	size_t block_cnt, best = SIZE_MAX, best_used = SIZE_MAX;
+	enum intr_level old_level;
+
+	if (page_cnt < first + HPG_PAGES)
+		return NULL;
+	block_cnt = (page_cnt - first) / HPG_PAGES;
+
+	old_level = spin_lock_irqsave (&pool->lock);
+	for (size_t i = 1; i <= block_cnt; i++) {
+		size_t block = (*cursor + i) % block_cnt;
+		size_t used = bitmap_count (pool->used_map, first + block * HPG_PAGES,
+		                            HPG_PAGES, true);
+		if (used > 0 && used < best_used) {
+			best = block;
+			best_used = used;
+		}
+	}
+	spin_unlock_irqrestore (&pool->lock, old_level);
+
+	if (best == SIZE_MAX || best_used > pool->free_pages)
+		return NULL;
+	*cursor = best;
+	return pool->base + PGSIZE * (first + best * HPG_PAGES);
+}
+
+/* Starts compacting the 2 MB block at BLOCK in the user pool.
+   Takes the block's free pages off the free lists, so that the
+   pages its contents move to come from elsewhere.
+   Returns the number of pages in the block still in use.  Pages
+   of the block freed before palloc_compact_end() are not handed
+   out either.  Only one block may be compacted at a time. */
+size_t
+palloc_compact_begin (void *block) {
+	struct pool *pool = &user_pool;
+	size_t start = pg_no (block) - pg_no (pool->base);
+	enum intr_level old_level;
+	size_t used;
+
+	ASSERT (hpg_ofs (vtop (block)) == 0);
+
+	old_level = spin_lock_irqsave (&pool->lock);
+	ASSERT (pool->compacting == SIZE_MAX);
+	release_zeroed (pool);
+	for (size_t i = start; i < start + HPG_PAGES; i++)
+		if (pool->order_map[i] != 0)
+			buddy_remove (pool, i, pool->order_map[i] - 1);
+	pool->compacting = start;
+	used = bitmap_count (pool->used_map, start, HPG_PAGES, true);
+	spin_unlock_irqrestore (&pool->lock, old_level);
+	return used;
+}
+
+/* Finishes compacting the 2 MB block at BLOCK.  If SUCCESS, every
+   page in it has been moved away and the whole block becomes one
+   free block.  Otherwise its free pages go back on the free
+   lists; pages that were moved must then be freed by the
+   caller. */
+void
+palloc_compact_end (void *block, bool success) {
+	struct pool *pool = &user_pool;
+	size_t start = pg_no (block) - pg_no (pool->base);
+	enum intr_level old_level;
+
+	old_level = spin_lock_irqsave (&pool->lock);
+	ASSERT (pool->compacting == start);
+	pool->compacting = SIZE_MAX;
+	if (success) {
+		bitmap_set_multiple (pool->used_map, start, HPG_PAGES, false);
+		buddy_free (pool, start, HPG_PAGES);
+		pool->compactions++;
+	} else {
+		size_t i = start, end = start + HPG_PAGES;
+		while (i < end) {
+			size_t run = bitmap_scan (pool->used_map, i, 1, false);
+			size_t run_end;
+
+			if (run == BITMAP_ERROR || run >= end)
+				break;
+			run_end = bitmap_scan (pool->used_map, run, 1, true);
+			if (run_end == BITMAP_ERROR || run_end > end)
+				run_end = end;
+			buddy_free (pool, run, run_end - run);
+			i = run_end;
+		}
+	}
+	spin_unlock_irqrestore (&pool->lock, old_level);
+}
+
+/* Takes one free page from POOL, fills it with zeros and puts it
+   on POOL's zeroed stack.  Returns false if there was nothing to
+   do. */
+static bool
+zero_one_page (struct pool *pool) {
+	enum intr_level old_level = spin_lock_irqsave (&pool->lock);
+	size_t page_idx = BITMAP_ERROR;
+
+	if (pool->zeroed_cnt < ZEROED_MAX)
+		page_idx = buddy_alloc (pool, 1);
+	if (page_idx != BITMAP_ERROR)
+		bitmap_mark (pool->used_map, page_idx);
+	spin_unlock_irqrestore (&pool->lock, old_level);
+	if (page_idx == BITMAP_ERROR)
+		return false;
+
+	/* Zero outside the lock; the page is ours meanwhile. */
+	memset (pool->base + PGSIZE * page_idx, 0, PGSIZE);
+
+	old_level = spin_lock_irqsave (&pool->lock);
+	if (pool->zeroed_cnt < ZEROED_MAX)
+		pool->zeroed[pool->zeroed_cnt++] = page_idx;
+	else {
+		bitmap_reset (pool->used_map, page_idx);
+		free_range (pool, page_idx, 1);
+	}
+	spin_unlock_irqrestore (&pool->lock, old_level);
+	return true;
+}
+
+/* Zeros one free page in the background, if any pool's zeroed
+   stack has room.  Called by the idle thread with interrupts on.
+   Returns true if it zeroed a page, false if there was nothing
+   to do. */
+bool
+palloc_zero_idle (void) {
+	return zero_one_page (&user_pool) || zero_one_page (&kernel_pool);
+}
+
+/* Gives every page on POOL's zeroed stack back to the buddy
+   allocator.  POOL's lock must be held. */
+static void
+release_zeroed (struct pool *pool) {
+	while (pool->zeroed_cnt > 0) {
+		size_t page_idx = pool->zeroed[--pool->zeroed_cnt];
+		bitmap_reset (pool->used_map, page_idx);
+		free_range (pool, page_idx, 1);
+	}
+}
+
 /* Initializes pool P as starting at START and ending at END */
 static void
 init_pool (struct pool *p, void **bm_base, uint64_t start, uint64_t end) {
@@ -336,8 +630,9 @@ init_pool (struct pool *p, void **bm_base, uint64_t start, uint64_t end) {
      and subtract it from the pool's size. */
 	uint64_t pgcnt = (end - start) / PGSIZE;
 	size_t bm_pages = DIV_ROUND_UP (bitmap_buf_size (pgcnt), PGSIZE) * PGSIZE;
+	size_t om_pages = DIV_ROUND_UP (pgcnt, PGSIZE) * PGSIZE;
 
-	lock_init(&p->lock);
+	spinlock_init(&p->lock);
 	p->used_map = bitmap_create_in_buf (pgcnt, *bm_base, bm_pages);
 	p->base = (void *) start;
 
@@ -345,6 +640,23 @@ init_pool (struct pool *p, void **bm_base, uint64_t start, uint64_t end) {
 	bitmap_set_all(p->used_map, true);
 
 	*bm_base += bm_pages;
+
+	// No free blocks until populate_pools() hands them over.
+	p->order_map = *bm_base;
+	memset (p->order_map, 0, pgcnt);
+	for (int order = 0; order < BUDDY_ORDERS; order++) {
+		list_init (&p->free_list[order]);
+		p->free_blocks[order] = 0;
+	}
+	p->free_orders = 0;
+	p->free_pages = 0;
+	p->zeroed_cnt = 0;
+	p->zeroed_hits = 0;
+	p->compact_requested = false;
+	p->compacting = SIZE_MAX;
+	p->compactions = 0;
+
+	*bm_base += om_pages;
 }
 
 /* Returns true if PAGE was allocated from POOL,
@@ -356,3 +668,137 @@ page_from_pool (const struct pool *pool, void *page) {
 	size_t end_page = start_page + bitmap_size (pool->used_map);
 	return page_no >= start_page && page_no < end_page;
 }
+
+/* Returns the physical page number of page PAGE_IDX in POOL.
+   Buddies are paired by this number, so blocks stay aligned to
+   their size in physical memory. */
+static inline size_t
+pool_pfn (const struct pool *pool, size_t page_idx) {
+	return pg_no (vtop (pool->base)) + page_idx;
+}
+
+/* Returns the free list element stored in page PAGE_IDX. */
+static inline struct list_elem *
+block_elem (const struct pool *pool, size_t page_idx) {
+	return (struct list_elem *) (pool->base + PGSIZE * page_idx);
+}
+
+/* Puts the free block of 2**ORDER pages at PAGE_IDX on POOL's
+   free list for ORDER. */
+static void
+buddy_push (struct pool *pool, size_t page_idx, int order) {
+	list_push_front (&pool->free_list[order], block_elem (pool, page_idx));
+	pool->order_map[page_idx] = order + 1;
+	pool->free_blocks[order]++;
+	pool->free_orders |= 1u << order;
+	pool->free_pages += (size_t) 1 << order;
+}
+
+/* Takes the free block of 2**ORDER pages at PAGE_IDX off POOL's
+   free list for ORDER. */
+static void
+buddy_remove (struct pool *pool, size_t page_idx, int order) {
+	ASSERT (pool->order_map[page_idx] == order + 1);
+
+	list_remove (block_elem (pool, page_idx));
+	pool->order_map[page_idx] = 0;
+	if (--pool->free_blocks[order] == 0)
+		pool->free_orders &= ~(1u << order);
+	pool->free_pages -= (size_t) 1 << order;
+}
+
+/* Frees the block of 2**ORDER pages at PAGE_IDX, merging it with
+   its buddy for as long as the buddy is free too. */
+static void
+buddy_free_block (struct pool *pool, size_t page_idx, int order) {
+	size_t page_cnt = bitmap_size (pool->used_map);
+	size_t base_pfn = pool_pfn (pool, 0);
+
+	while (order < BUDDY_MAX_ORDER) {
+		size_t buddy_pfn = pool_pfn (pool, page_idx) ^ ((size_t) 1 << order);
+		size_t buddy_idx = buddy_pfn - base_pfn;
+
+		if (buddy_pfn < base_pfn || buddy_idx >= page_cnt
+				|| pool->order_map[buddy_idx] != order + 1)
+			break;
+		buddy_remove (pool, buddy_idx, order);
+		if (buddy_idx < page_idx)
+			page_idx = buddy_idx;
+		order++;
+	}
+	buddy_push (pool, page_idx, order);
+}
+
+/* Frees PAGE_CNT pages starting at PAGE_IDX.  The range is split
+   into the largest aligned blocks it contains, and each block is
+   freed separately. */
+static void
+buddy_free (struct pool *pool, size_t page_idx, size_t page_cnt) {
+	while (page_cnt > 0) {
+		int order = 0;
+
+		while (order < BUDDY_MAX_ORDER
+				&& pool_pfn (pool, page_idx) % ((size_t) 2 << order) == 0
+				&& ((size_t) 2 << order) <= page_cnt)
+			order++;
+		buddy_free_block (pool, page_idx, order);
+		page_idx += (size_t) 1 << order;
+		page_cnt -= (size_t) 1 << order;
+	}
+}
+
+/* Allocates PAGE_CNT contiguous pages from POOL and returns the
+   index of the first, or BITMAP_ERROR if no large enough block
+   is free. */
+static size_t
+buddy_alloc (struct pool *pool, size_t page_cnt) {
+	int need = 0, order;
+	unsigned avail;
+	size_t page_idx;
+
+	while (((size_t) 1 << need) < page_cnt)
+		need++;
+	if (need > BUDDY_MAX_ORDER)
+		return BITMAP_ERROR;
+
+	/* Smallest nonempty order that is large enough. */
+	avail = pool->free_orders & ~((1u << need) - 1);
+	if (avail == 0)
+		return BITMAP_ERROR;
+	order = __builtin_ctz (avail);
+
+	page_idx = (pg_no (list_front (&pool->free_list[order])) - pg_no (pool->base));
+	buddy_remove (pool, page_idx, order);
+
+	/* Split off the upper halves we do not need. */
+	while (order > need) {
+		order--;
+		buddy_push (pool, page_idx + ((size_t) 1 << order), order);
+	}
+
+	/* Give back the pages past PAGE_CNT. */
+	if (page_cnt < ((size_t) 1 << need))
+		buddy_free (pool, page_idx + page_cnt, ((size_t) 1 << need) - page_cnt);
+	return page_idx;
+}
+
+/* Prints the buddy allocator's free blocks for POOL. */
+static void
+print_pool_stats (const char *name, struct pool *pool) {
+	enum intr_level old_level = spin_lock_irqsave (&pool->lock);
+
+	printf ("Palloc %s pool: %zu of %zu pages free; blocks by order:",
+			name, pool->free_pages, bitmap_size (pool->used_map));
+	for (int order = 0; order < BUDDY_ORDERS; order++)
+		printf (" %zu", pool->free_blocks[order]);
+	printf ("; %zu pre-zeroed, %llu hits; %llu compactions\n",
+			pool->zeroed_cnt, pool->zeroed_hits, pool->compactions);
+	spin_unlock_irqrestore (&pool->lock, old_level);
+}
+
+/* Prints page allocator statistics. */
+void
+palloc_print_stats (void) {
+	print_pool_stats ("kernel", &kernel_pool);
+	print_pool_stats ("user", &user_pool);
+}
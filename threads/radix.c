@@ -0,0 +1,184 @@
+#include "threads/radix.h"
+#include <debug.h>
+#include <stdint.h>
+#include "threads/palloc.h"
+#include "threads/pte.h"
+#include "threads/vaddr.h"
+
+/* Radix tree keyed by virtual page.
+
+   The tree has four levels of 512-slot nodes, indexed by the same
+   9-bit fields of the address as the x86-64 page table: PML4,
+   PDPE, PDX, and PTX.  Each node is one page.  The slots of the
+   last level hold the values, so a lookup is always four loads,
+   however many values the tree holds, and it never has to pause
+   to grow a table the way a hash table rehashes.  Keys that are
+   close together share nodes, so iterating over a range of
+   addresses only visits the nodes under it.
+
+   Lookups take no lock.  Writers publish a new node only after
+   it is zeroed, and every slot is read and written atomically,
+   so a lookup sees either the old or the new value.  Writers
+   must be serialized by the caller.
+
+   Nodes are freed only by radix_destroy(), never when they
+   become empty, because a concurrent lookup may still be
+   reading them. */
+
+#define RADIX_LEVELS 4
+#define RADIX_SLOTS 512
+
+/* Returns the slot index for VA in a node at LEVEL (0 is the
+   root). */
+static inline unsigned
+slot_index (uint64_t va, int level) {
+	return (va >> (PML4SHIFT - 9 * level)) & (RADIX_SLOTS - 1);
+}
+
+/* Returns the number of bytes of address space a slot at LEVEL
+   covers. */
+static inline uint64_t
+slot_span (int level) {
+	return 1ULL << (PML4SHIFT - 9 * level);
+}
+
+/* Initializes TREE as empty. */
+void
+radix_init (struct radix_tree *tree) {
+	tree->root = NULL;
+	tree->node_cnt = 0;
+	tree->value_cnt = 0;
+}
+
+/* Returns the value stored at virtual page VA in TREE, or a null
+   pointer if there is none.  VA need not be page-aligned. */
+void *
+radix_lookup (const struct radix_tree *tree, const void *va) {
+	void **node = __atomic_load_n (&tree->root, __ATOMIC_ACQUIRE);
+
+	for (int level = 0; node != NULL; level++) {
+		void *slot = __atomic_load_n (&node[slot_index ((uint64_t) va, level)],
+		                              __ATOMIC_ACQUIRE);
+		if (level == RADIX_LEVELS - 1)
+			return slot;
+		node = slot;
+	}
+	return NULL;
+}
+
+/* Returns the last-level slot for VA in TREE.  Missing nodes are
+   created if CREATE is true; otherwise, or if memory is not
+   available, returns a null pointer when one is missing. */
+static void **
+walk (struct radix_tree *tree, uint64_t va, bool create) {
+	void **link = (void **) &tree->root;
+
+	for (int level = 0; level < RADIX_LEVELS; level++) {
+		void **node = *link;
+
+		if (node == NULL) {
+			if (!create || (node = palloc_get_page (PAL_ZERO)) == NULL)
+				return NULL;
+			__atomic_store_n (link, node, __ATOMIC_RELEASE);
+			tree->node_cnt++;
+		}
+		link = &node[slot_index (va, level)];
+	}
+	return link;
+}
+
+/* Stores VALUE, which must not be null, at virtual page VA in
+   TREE.  Returns false if VA already has a value or if memory is
+   not available. */
+bool
+radix_insert (struct radix_tree *tree, const void *va, void *value) {
+	void **slot;
+
+	ASSERT (value != NULL);
+
+	slot = walk (tree, (uint64_t) va, true);
+	if (slot == NULL || *slot != NULL)
+		return false;
+	__atomic_store_n (slot, value, __ATOMIC_RELEASE);
+	tree->value_cnt++;
+	return true;
+}
+
+/* Removes the value stored at virtual page VA in TREE and
+   returns it, or returns a null pointer if there is none. */
+void *
+radix_remove (struct radix_tree *tree, const void *va) {
+	void **slot = walk (tree, (uint64_t) va, false);
+	void *value;
+
+	if (slot == NULL || *slot == NULL)
+		return NULL;
+	value = *slot;
+	__atomic_store_n (slot, NULL, __ATOMIC_RELEASE);
+	tree->value_cnt--;
+	return value;
+}
+
+/* Calls FUNC on every value in NODE, a node at LEVEL whose first
+   slot covers address BASE, that lies in [START, END). */
+static bool
+for_each_node (void **node, int level, uint64_t base, uint64_t start,
+               uint64_t end, radix_action_func *func, void *aux) {
+	uint64_t span = slot_span (level);
+	unsigned i = start > base ? (start - base) / span : 0;
+
+	for (; i < RADIX_SLOTS; i++) {
+		uint64_t lo = base + i * span;
+		void *slot;
+
+		if (lo >= end)
+			break;
+		slot = __atomic_load_n (&node[i], __ATOMIC_ACQUIRE);
+		if (slot == NULL)
+			continue;
+		if (level == RADIX_LEVELS - 1) {
+			if (!func ((void *) lo, slot, aux))
+				return false;
+		} else if (!for_each_node (slot, level + 1, lo, start, end, func, aux))
+			return false;
+	}
+	return true;
+}
+
+/* Calls FUNC on each value in TREE stored at a virtual page in
+   [START, END), in address order, until FUNC returns false.
+   FUNC may remove the value it is called on.  Returns false if
+   FUNC did. */
+bool
+radix_for_each (const struct radix_tree *tree, const void *start,
+                const void *end, radix_action_func *func, void *aux) {
+	void **root = __atomic_load_n (&tree->root, __ATOMIC_ACQUIRE);
+
+	if (root == NULL || start >= end)
+		return true;
+	return for_each_node (root, 0, 0, (uint64_t) start, (uint64_t) end,
+	                      func, aux);
+}
+
+/* Frees NODE, a node at LEVEL, and the nodes below it. */
+static void
+free_node (void **node, int level) {
+	if (level < RADIX_LEVELS - 1)
+		for (unsigned i = 0; i < RADIX_SLOTS; i++)
+			if (node[i] != NULL)
+				free_node (node[i], level + 1);
+	palloc_free_page (node);
+}
+
+/* Calls FUNC, if it is nonnull, on every value in TREE, then
+   frees all of TREE's nodes, leaving it empty.  FUNC must return
+   true. */
+void
+radix_destroy (struct radix_tree *tree, radix_action_func *func, void *aux) {
+	if (tree->root == NULL)
+		return;
+	if (func != NULL)
+		for_each_node (tree->root, 0, 0, 0, UINT64_MAX, func, aux);
+	free_node (tree->root, 0);
+	radix_init (tree);
+}
@@ -0,0 +1,289 @@
+#include "threads/slab.h"
+#include <debug.h>
+#include <list.h>
+#include <round.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
+
+/* Slab allocator.
+
+   A cache hands out objects of exactly one size.  It gets memory
+   from the page allocator one page (a "slab") at a time and
+   carves each slab into as many objects as fit after a small
+   header.  Unlike malloc(), which rounds every request up to a
+   power of 2, the only waste is the tail of each slab.
+
+   Free objects in a slab are kept on a singly linked list.  The
+   link normally overlays an object's first word, but a cache
+   with a constructor gives each object an extra trailing word
+   for it so that the constructed state is never disturbed.
+
+   A cache keeps its slabs on a partial and a full list, plus at
+   most one empty slab.  Allocation takes from a partial slab
+   first, then from the empty slab, and only then asks for a new
+   page.  Any further slab that becomes empty goes back to the
+   page allocator.
+
+   If the cache has a constructor, it runs on each object once,
+   when its slab is created.  Callers must return objects to the
+   cache in their constructed state.
+
+   Successive slabs start their objects at different offsets
+   within the leftover tail ("cache coloring").  That way the same
+   object index in different slabs does not always map to the
+   same cache lines. */
+
+/* Cache line size, the unit of cache coloring. */
+#define CACHE_LINE 64
+
+/* Magic number for detecting slab corruption. */
+#define SLAB_MAGIC 0x51ab51ab
+
+/* Cache. */
+struct kmem_cache {
+	const char *name;           /* Name (for statistics). */
+	size_t obj_size;            /* Size of each object, rounded up. */
+	size_t link_ofs;            /* Offset of free list link in object. */
+	size_t objs_per_slab;       /* Number of objects in a slab. */
+	kmem_ctor_func *ctor;       /* Constructor, or null. */
+	size_t color_max;           /* Largest color offset. */
+	size_t color_next;          /* Color offset for the next slab. */
+
+	struct list partial;        /* Slabs with some objects free. */
+	struct list full;           /* Slabs with no objects free. */
+	struct slab *empty;         /* Slab with every object free. */
+	struct spinlock lock;       /* Protects everything above. */
+
+	/* Statistics. */
+	size_t slab_cnt;            /* Slabs currently allocated. */
+	size_t in_use;              /* Objects currently allocated. */
+	unsigned long long allocs;  /* Total kmem_cache_alloc() calls. */
+
+	struct list_elem elem;      /* Element in cache list. */
+};
+
+/* Slab header, at the start of each slab's page. */
+struct slab {
+	unsigned magic;             /* Always set to SLAB_MAGIC. */
+	struct kmem_cache *cache;   /* Owning cache. */
+	struct list_elem elem;      /* Element in cache's slab list. */
+	size_t in_use;              /* Number of objects allocated. */
+	void *free;                 /* First free object. */
+};
+
+/* All caches, for statistics. */
+static struct list caches;
+static struct spinlock caches_lock;
+
+static struct slab *slab_create (struct kmem_cache *);
+
+/* Returns the free list link of OBJ in cache C. */
+static inline void **
+obj_link (const struct kmem_cache *c, void *obj) {
+	return (void **) ((uint8_t *) obj + c->link_ofs);
+}
+
+/* Initializes the slab allocator. */
+void
+kmem_init (void) {
+	list_init (&caches);
+	spinlock_init (&caches_lock);
+}
+
+/* Creates and returns a cache of SIZE-byte objects named NAME.
+   If CTOR is nonnull, it is run once on each object when its
+   slab is created.  Panics if memory is not available. */
+struct kmem_cache *
+kmem_cache_create (const char *name, size_t size, kmem_ctor_func *ctor) {
+	struct kmem_cache *c;
+	size_t space = PGSIZE - sizeof (struct slab);
+	enum intr_level old_level;
+
+	ASSERT (name != NULL);
+	ASSERT (size > 0);
+
+	c = malloc (sizeof *c);
+	if (c == NULL)
+		PANIC ("kmem_cache_create: out of memory");
+
+	/* Objects must hold the free list link and stay aligned. */
+	if (size < sizeof (void *))
+		size = sizeof (void *);
+	c->name = name;
+	c->obj_size = ROUND_UP (size, sizeof (void *));
+	c->link_ofs = 0;
+	if (ctor != NULL) {
+		c->link_ofs = c->obj_size;
+		c->obj_size += sizeof (void *);
+	}
+	c->objs_per_slab = space / c->obj_size;
+	ASSERT (c->objs_per_slab > 0);
+	c->ctor = ctor;
+	c->color_max = ROUND_DOWN (space - c->objs_per_slab * c->obj_size,
+	                           CACHE_LINE);
+	c->color_next = 0;
+
+	list_init (&c->partial);
+	list_init (&c->full);
+	c->empty = NULL;
+	spinlock_init (&c->lock);
+
+	c->slab_cnt = 0;
+	c->in_use = 0;
+	c->allocs = 0;
+
+	old_level = spin_lock_irqsave (&caches_lock);
+	list_push_back (&caches, &c->elem);
+	spin_unlock_irqrestore (&caches_lock, old_level);
+	return c;
+}
+
+/* Obtains and returns an object from cache C.  Returns a null
+   pointer if memory is not available. */
+void *
+kmem_cache_alloc (struct kmem_cache *c) {
+	struct slab *s;
+	void *obj;
+	enum intr_level old_level;
+
+	ASSERT (c != NULL);
+
+	old_level = spin_lock_irqsave (&c->lock);
+	if (!list_empty (&c->partial))
+		s = list_entry (list_front (&c->partial), struct slab, elem);
+	else if (c->empty != NULL) {
+		s = c->empty;
+		c->empty = NULL;
+		list_push_front (&c->partial, &s->elem);
+	} else {
+		s = slab_create (c);
+		if (s == NULL) {
+			spin_unlock_irqrestore (&c->lock, old_level);
+			return NULL;
+		}
+		list_push_front (&c->partial, &s->elem);
+	}
+
+	/* Take the first free object. */
+	obj = s->free;
+	s->free = *obj_link (c, obj);
+	if (++s->in_use == c->objs_per_slab) {
+		list_remove (&s->elem);
+		list_push_front (&c->full, &s->elem);
+	}
+	c->in_use++;
+	c->allocs++;
+	spin_unlock_irqrestore (&c->lock, old_level);
+	return obj;
+}
+
+/* Returns OBJ, which must have been obtained from cache C, to C. */
+void
+kmem_cache_free (struct kmem_cache *c, void *obj) {
+	struct slab *s;
+	enum intr_level old_level;
+
+	if (obj == NULL)
+		return;
+
+	s = pg_round_down (obj);
+	ASSERT (s->magic == SLAB_MAGIC);
+	ASSERT (s->cache == c);
+
+	old_level = spin_lock_irqsave (&c->lock);
+	if (s->in_use-- == c->objs_per_slab) {
+		/* Full slab becomes partial. */
+		list_remove (&s->elem);
+		list_push_front (&c->partial, &s->elem);
+	}
+	*obj_link (c, obj) = s->free;
+	s->free = obj;
+	c->in_use--;
+
+	if (s->in_use == 0) {
+		/* Keep one empty slab around; give back any other. */
+		list_remove (&s->elem);
+		if (c->empty == NULL)
+			c->empty = s;
+		else {
+			c->slab_cnt--;
+			palloc_free_page (s);
+		}
+	}
+	spin_unlock_irqrestore (&c->lock, old_level);
+}
+
+/* Returns true if OBJ was obtained from some kmem cache. */
+bool
+kmem_owns (const void *obj) {
+	const struct slab *s = pg_round_down (obj);
+
+	return obj != NULL && s->magic == SLAB_MAGIC;
+}
+
+/* Returns OBJ, which must have been obtained from a kmem cache,
+   to the cache it came from. */
+void
+kmem_free (void *obj) {
+	struct slab *s = pg_round_down (obj);
+
+	ASSERT (kmem_owns (obj));
+	kmem_cache_free (s->cache, obj);
+}
+
+/* Prints statistics for every cache. */
+void
+kmem_print_stats (void) {
+	struct list_elem *e;
+	enum intr_level old_level = spin_lock_irqsave (&caches_lock);
+
+	for (e = list_begin (&caches); e != list_end (&caches); e = list_next (e)) {
+		struct kmem_cache *c = list_entry (e, struct kmem_cache, elem);
+		printf ("Slab %s: %zu-byte objects, %zu in use, %zu slabs, %llu allocs\n",
+		        c->name, c->obj_size, c->in_use, c->slab_cnt, c->allocs);
+	}
+	spin_unlock_irqrestore (&caches_lock, old_level);
+}
+
+/* Allocates a new slab for cache C and threads all of its
+   objects onto its free list, running C's constructor on each.
+   Returns a null pointer if memory is not available.  C's lock
+   must be held. */
+static struct slab *
+slab_create (struct kmem_cache *c) {
+	struct slab *s;
+	uint8_t *base;
+	size_t i;
+
+	s = palloc_get_page (0);
+	if (s == NULL)
+		return NULL;
+
+	s->magic = SLAB_MAGIC;
+	s->cache = c;
+	s->in_use = 0;
+	s->free = NULL;
+
+	/* Pick this slab's color. */
+	base = (uint8_t *) (s + 1) + c->color_next;
+	c->color_next += CACHE_LINE;
+	if (c->color_next > c->color_max)
+		c->color_next = 0;
+
+	/* Build the free list back to front, so objects are handed out
+	   in address order. */
+	for (i = c->objs_per_slab; i-- > 0; ) {
+		void *obj = base + i * c->obj_size;
+		if (c->ctor != NULL)
+			c->ctor (obj);
+		*obj_link (c, obj) = s->free;
+		s->free = obj;
+	}
+	c->slab_cnt++;
+	return s;
+}
@@ -67,6 +67,8 @@ sema_down (struct semaphore *sema) {
    old_level = intr_disable ();
    while (sema->value == 0) {
       // Semaphore를 얻고 writers 리스트 삽입 시, 우선순위대로 삽입되도록 수정
+      // 기다리는 동안 우선순위가 바뀌면 donation 쪽에서 위치를 다시 잡아준다.
+      thread_current ()->wait_on_sema = sema;
       list_insert_ordered(&sema->waiters, &thread_current()->elem, cmp_priority, NULL);
       //list_push_back (&sema->waiters, &thread_current ()->elem);
       thread_block ();
@@ -112,12 +114,11 @@ sema_up (struct semaphore *sema) {
 
    old_level = intr_disable ();
    if (!list_empty (&sema->waiters)){
-      list_sort(&sema->waiters,cmp_priority,NULL);
-      /* waiter list에 있는 쓰레드의 우선순위가 변경 되었을 경우를 고려하여
-      waiter list를 정렬 (list_sort)*/
-      thread_unblock (list_entry (list_pop_front (&sema->waiters),
-               struct thread, elem));
-      /*priority preemption 기능 추가 (구현중)*/
+      /* waiters는 항상 우선순위 순서이므로 맨 앞이 가장 높다. */
+      struct thread *t = list_entry (list_pop_front (&sema->waiters),
+               struct thread, elem);
+      t->wait_on_sema = NULL;
+      thread_unblock (t);
    }
    sema->value++;
    test_max_priority();
@@ -159,6 +160,99 @@ sema_test_helper (void *sema_) {
    }
 }
 
+/* Initializes priority set SET to empty. */
+void
+prio_set_init (struct prio_set *set) {
+   ASSERT (set != NULL);
+
+   memset (set, 0, sizeof *set);
+}
+
+/* Adds one entry at PRIORITY to SET. */
+void
+prio_set_add (struct prio_set *set, int priority) {
+   ASSERT (0 <= priority && priority < PRIO_SET_SIZE);
+
+   set->cnt[priority]++;
+   set->mask |= 1ULL << priority;
+}
+
+/* Removes one entry at PRIORITY from SET, which must have one. */
+void
+prio_set_remove (struct prio_set *set, int priority) {
+   ASSERT (0 <= priority && priority < PRIO_SET_SIZE);
+   ASSERT (set->cnt[priority] > 0);
+
+   if (--set->cnt[priority] == 0)
+      set->mask &= ~(1ULL << priority);
+}
+
+/* Returns the highest priority in SET, or -1 if SET is empty. */
+int
+prio_set_max (const struct prio_set *set) {
+   if (set->mask == 0)
+      return -1;
+   return 63 - __builtin_clzll (set->mask);
+}
+
+/* Initializes spinlock SL. */
+void
+spinlock_init (struct spinlock *sl) {
+   ASSERT (sl != NULL);
+
+   sl->next = 0;
+   sl->owner = 0;
+   sl->holder = NULL;
+}
+
+/* Acquires SL, spinning until our ticket comes up.  Tickets are
+   served in the order they were taken, so waiters cannot starve.
+
+   Interrupts must be off: a thread preempted while holding or
+   waiting for a spinlock would leave everyone else spinning.
+   Use spin_lock_irqsave() when that is not already the case. */
+void
+spin_lock (struct spinlock *sl) {
+   unsigned ticket;
+
+   ASSERT (sl != NULL);
+   ASSERT (intr_get_level () == INTR_OFF);
+   ASSERT (sl->holder != thread_current ());
+
+   ticket = __atomic_fetch_add (&sl->next, 1, __ATOMIC_RELAXED);
+   while (__atomic_load_n (&sl->owner, __ATOMIC_ACQUIRE) != ticket)
+      asm volatile ("pause" : : : "memory");
+   sl->holder = thread_current ();
+}
+
+/* Releases SL, handing it to the next ticket in line. */
+void
+spin_unlock (struct spinlock *sl) {
+   ASSERT (sl != NULL);
+   ASSERT (sl->holder == thread_current ());
+
+   sl->holder = NULL;
+   __atomic_store_n (&sl->owner, sl->owner + 1, __ATOMIC_RELEASE);
+}
+
+/* Disables interrupts, acquires SL, and returns the previous
+   interrupt level for spin_unlock_irqrestore().  May be called
+   from an interrupt handler. */
+enum intr_level
+spin_lock_irqsave (struct spinlock *sl) {
+   enum intr_level old_level = intr_disable ();
+
+   spin_lock (sl);
+   return old_level;
+}
+
+/* Releases SL and restores the interrupt level OLD_LEVEL. */
+void
+spin_unlock_irqrestore (struct spinlock *sl, enum intr_level old_level) {
+   spin_unlock (sl);
+   intr_set_level (old_level);
+}
+
 /* Initializes LOCK.  A lock can be held by at most a single
    thread at any given time.  Our locks are not "recursive", that
    is, it is an error for the thread currently holding a lock to
@@ -180,6 +274,24 @@ lock_init (struct lock *lock) {
 
    lock->holder = NULL;
    sema_init (&lock->semaphore, 1);
+   prio_set_init (&lock->waiters);
+}
+
+/* Makes the current thread the holder of LOCK.  Threads still
+   registered as waiters on LOCK start donating to it.  Must be
+   called with interrupts off. */
+static void
+lock_take (struct lock *lock) {
+   struct thread *cur = thread_current ();
+   int max = prio_set_max (&lock->waiters);
+
+   ASSERT (intr_get_level () == INTR_OFF);
+
+   lock->holder = cur;
+   if (max >= 0) {
+      prio_set_add (&cur->held, max);
+      refresh_priority ();
+   }
 }
 
 /* Acquires LOCK, sleeping until it becomes available if
@@ -192,21 +304,38 @@ lock_init (struct lock *lock) {
    we need to sleep. */
 void
 lock_acquire (struct lock *lock) {
+   enum intr_level old_level;
+
    ASSERT (lock != NULL);
    ASSERT (!intr_context ());
    ASSERT (!lock_held_by_current_thread (lock));
 
-	if (lock->holder){
-		struct thread *cur = thread_current();
+	/* Fast path: 아무도 lock을 갖고 있지 않으면 donation 없이 바로 획득. */
+	old_level = intr_disable ();
+	if (lock->semaphore.value > 0) {
+		lock->semaphore.value--;
+		lock_take (lock);
+		intr_set_level (old_level);
+		return;
+	}
+	intr_set_level (old_level);
+
+	/* MLFQS에서는 priority donation을 하지 않는다. */
+	struct thread *cur = thread_current();
+	if (!thread_mlfqs){
 		cur->wait_on_lock = lock;
-		list_insert_ordered(&lock->holder->donations, &cur->donation_elem,
-			thread_compare_donate_priority,NULL);
 		donate_priority();
 	}
 
    sema_down (&lock->semaphore);
-   thread_current()->wait_on_lock = NULL;
-   lock->holder = thread_current ();
+
+   old_level = intr_disable ();
+   if (!thread_mlfqs) {
+      cur->wait_on_lock = NULL;
+      prio_set_remove (&lock->waiters, cur->priority);
+   }
+   lock_take (lock);
+   intr_set_level (old_level);
 }
 
 /* Tries to acquires LOCK and returns true if successful or false
@@ -223,8 +352,11 @@ lock_try_acquire (struct lock *lock) {
    ASSERT (!lock_held_by_current_thread (lock));
 
    success = sema_try_down (&lock->semaphore);
-   if (success)
-      lock->holder = thread_current ();
+   if (success) {
+      enum intr_level old_level = intr_disable ();
+      lock_take (lock);
+      intr_set_level (old_level);
+   }
    return success;
 }
 
@@ -236,15 +368,30 @@ lock_try_acquire (struct lock *lock) {
    handler. */
 void
 lock_release (struct lock *lock) {
+   enum intr_level old_level;
+
    ASSERT (lock != NULL);
    ASSERT (lock_held_by_current_thread (lock));
 
-	// 두줄 추가
-	remove_with_lock(lock);
-  	refresh_priority();
+	/* Fast path: 기다리는 스레드가 없으면 이 lock으로 받은 donation도
+	   없으므로 우선순위를 다시 계산하거나 깨울 스레드가 없다. */
+	old_level = intr_disable ();
+	if (list_empty (&lock->semaphore.waiters)
+		&& prio_set_max (&lock->waiters) < 0) {
+		lock->holder = NULL;
+		lock->semaphore.value++;
+		intr_set_level (old_level);
+		return;
+	}
 
+	// 이 lock으로 받은 donation을 빼고 우선순위를 다시 계산
+	if (!thread_mlfqs)
+		remove_with_lock(lock);
    lock->holder = NULL;
+	if (!thread_mlfqs)
+		refresh_priority();
    sema_up (&lock->semaphore);
+   intr_set_level (old_level);
 }
 
 /* Returns true if the current thread holds LOCK, false
@@ -257,6 +404,90 @@ lock_held_by_current_thread (const struct lock *lock) {
    return lock->holder == thread_current ();
 }
 
+/* Initializes RW.  Any number of readers may hold RW at once,
+   or a single writer.
+
+   A writer keeps RW's internal lock for as long as it writes, so
+   threads blocked behind it donate their priority to it in the
+   usual way, and the lock's waiters are woken in priority order.
+   Readers only pass through that lock on the way in, which gives
+   writers preference: once a writer is waiting for the current
+   readers to drain, new readers queue up behind it.  Active
+   readers cannot receive donations, since there may be many of
+   them. */
+void
+rwlock_init (struct rwlock *rw) {
+   ASSERT (rw != NULL);
+
+   lock_init (&rw->lock);
+   rw->readers = 0;
+   rw->writer_waiting = false;
+   sema_init (&rw->drain, 0);
+}
+
+/* Acquires RW for reading, sleeping while a writer holds it or
+   is waiting for it. */
+void
+rwlock_acquire_read (struct rwlock *rw) {
+   enum intr_level old_level;
+
+   ASSERT (rw != NULL);
+   ASSERT (!intr_context ());
+
+   lock_acquire (&rw->lock);
+   old_level = intr_disable ();
+   rw->readers++;
+   intr_set_level (old_level);
+   lock_release (&rw->lock);
+}
+
+/* Releases RW, which the current thread must hold for reading.
+   The last reader out wakes a waiting writer. */
+void
+rwlock_release_read (struct rwlock *rw) {
+   enum intr_level old_level;
+
+   ASSERT (rw != NULL);
+   ASSERT (rw->readers > 0);
+
+   old_level = intr_disable ();
+   if (--rw->readers == 0 && rw->writer_waiting) {
+      rw->writer_waiting = false;
+      sema_up (&rw->drain);
+   }
+   intr_set_level (old_level);
+}
+
+/* Acquires RW for writing, sleeping until no other writer holds
+   it and all readers have left. */
+void
+rwlock_acquire_write (struct rwlock *rw) {
+   enum intr_level old_level;
+
+   ASSERT (rw != NULL);
+   ASSERT (!intr_context ());
+
+   lock_acquire (&rw->lock);
+
+   /* lock을 쥐고 있으므로 새 reader는 들어올 수 없다.
+      남은 reader들이 다 나갈 때까지만 기다리면 된다. */
+   old_level = intr_disable ();
+   if (rw->readers > 0) {
+      rw->writer_waiting = true;
+      sema_down (&rw->drain);
+   }
+   intr_set_level (old_level);
+}
+
+/* Releases RW, which the current thread must hold for writing. */
+void
+rwlock_release_write (struct rwlock *rw) {
+   ASSERT (rw != NULL);
+   ASSERT (rw->readers == 0);
+
+   lock_release (&rw->lock);
+}
+
 /* One semaphore in a list. */
 struct semaphore_elem {
    struct list_elem elem;              /* List element. */
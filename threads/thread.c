@@ -7,9 +7,13 @@
 #include "threads/flags.h"
 #include "threads/interrupt.h"
 #include "threads/intr-stubs.h"
+#include "threads/malloc.h"
 #include "threads/palloc.h"
 #include "threads/synch.h"
 #include "threads/vaddr.h"
+#include "threads/vmalloc.h"
+#include "threads/fixed_point.h"
+#include "devices/timer.h"
 #include "intrinsic.h"
 #ifdef USERPROG
 #include "userprog/process.h"
@@ -25,11 +29,13 @@
 #define THREAD_BASIC 0xd42df210
 
 /* List of processes in THREAD_READY state, that is, processes
-   that are ready to run but not actually running. */
-static struct list ready_list;
-
-/* ready list와 비슷한 방식으로 sleep_list 추가!*/
-static struct list sleep_list;
+   that are ready to run but not actually running.
+   우선순위마다 FIFO 큐를 하나씩 두고, 비어있지 않은 큐를 ready_mask의
+   비트로 표시한다.  (bit N == ready_queues[N] 에 스레드가 있음)
+   삽입/삭제/최고 우선순위 조회가 모두 O(1)이다. */
+static struct list ready_queues[PRI_MAX + 1];
+static uint64_t ready_mask;
+static int ready_cnt;           /* ready queue에 있는 스레드 수. */
 
 /* Idle thread. */
 static struct thread *idle_thread;
@@ -43,6 +49,9 @@ static struct lock tid_lock;
 /* Thread destruction requests */
 static struct list destruction_req;
 
+/* 살아 있는 모든 스레드.  thread_foreach()용. */
+static struct list all_list;
+
 /* Statistics. */
 static long long idle_ticks;   /* # of timer ticks spent idle. */
 static long long kernel_ticks; /* # of timer ticks in kernel threads. */
@@ -57,6 +66,15 @@ static unsigned thread_ticks; /* # of timer ticks since last yield. */
    Controlled by kernel command-line option "-o mlfqs". */
 bool thread_mlfqs;
 
+/* MLFQS 상태.  load_avg와 recent_cpu는 17.14 고정소수점이다.
+   recent_cpu의 1초 단위 감쇠는 실행 중이거나 ready인 스레드에만 바로
+   적용하고, block된 스레드는 깨어날 때 decay_history에 남겨둔 계수로
+   밀린 만큼 한꺼번에 적용한다.  그래서 매초 모든 스레드를 돌지 않는다. */
+#define DECAY_HISTORY 256
+static int load_avg;
+static int64_t mlfqs_epoch;             /* 지금까지 지난 초. */
+static int decay_history[DECAY_HISTORY]; /* 초마다의 recent_cpu 감쇠 계수. */
+
 static void kernel_thread(thread_func *, void *aux);
 
 static void idle(void *aux UNUSED);
@@ -65,8 +83,13 @@ static void init_thread(struct thread *, const char *name, int priority);
 static void do_schedule(int status);
 static void schedule(void);
 static tid_t allocate_tid(void);
-
-int64_t next_tick_to_awake;
+static timer_event_func thread_wakeup;
+static void mlfqs_update_priority(struct thread *);
+static void mlfqs_catch_up(struct thread *);
+static void mlfqs_second(void);
+static void ready_queue_push(struct thread *);
+static struct thread *ready_queue_pop(void);
+static int ready_queue_max_priority(void);
 
 /* Returns true if T appears to point to a valid thread. */
 #define is_thread(t) ((t) != NULL && (t)->magic == THREAD_MAGIC)
@@ -110,11 +133,14 @@ void thread_init(void)
 
 	/* Init the globla thread context */
 	lock_init(&tid_lock);
-	list_init(&ready_list);
-	list_init(&sleep_list); // ready list와 같이 초가화!
+	for (int pri = PRI_MIN; pri <= PRI_MAX; pri++)
+		list_init(&ready_queues[pri]);
+	ready_mask = 0;
+	ready_cnt = 0;
+	load_avg = 0;
+	mlfqs_epoch = 0;
 	list_init(&destruction_req);
-
-	next_tick_to_awake = INT64_MAX;
+	list_init(&all_list);
 
 
 	/* Set up a thread structure for the running thread. */
@@ -156,6 +182,24 @@ void thread_tick(void)
 	else
 		kernel_ticks++;
 
+	if (thread_mlfqs)
+	{
+		int64_t now = timer_ticks();
+
+		/* recent_cpu는 실행 중인 스레드만 매 tick 증가 */
+		if (t != idle_thread)
+			t->recent_cpu = add_mixed(t->recent_cpu, 1);
+
+		if (now % TIMER_FREQ == 0)
+			mlfqs_second();
+		else if (now % 4 == 0)
+			/* 지난 4 tick 동안 바뀐 입력은 현재 스레드의 recent_cpu뿐 */
+			mlfqs_update_priority(t);
+
+		if (t->priority < ready_queue_max_priority())
+			intr_yield_on_return();
+	}
+
 	/* Enforce preemption. */
 	if (++thread_ticks >= TIME_SLICE)
 		intr_yield_on_return();
@@ -200,6 +244,17 @@ tid_t thread_create(const char *name, int priority,
 	init_thread(t, name, priority);
 	tid = t->tid = allocate_tid();
 
+	/* MLFQS: nice와 recent_cpu는 부모에게서 물려받는다. */
+	if (thread_mlfqs)
+	{
+		struct thread *parent = thread_current();
+		t->nice = parent->nice;
+		t->recent_cpu = parent->recent_cpu;
+		t->mlfqs_epoch = mlfqs_epoch;
+		if (function != idle)
+			mlfqs_update_priority(t);
+	}
+
 	/* Call the kernel_thread if it scheduled.
 	 * Note) rdi is 1st argument, and rsi is 2nd argument. */
 	t->tf.rip = (uintptr_t)kernel_thread;
@@ -215,7 +270,8 @@ tid_t thread_create(const char *name, int priority,
 	list_push_back(&thread_current()->child_list, &t->child_elem);
 
 	/* File Descriptor 테이블 메모리 할당 */
-	t->fdt = palloc_get_multiple(PAL_ZERO, FDT_PAGES);
+	/* 물리적으로 연속될 필요가 없으므로 vmalloc 영역에서 받는다. */
+	t->fdt = vzalloc(FDT_PAGES * PGSIZE);
 	if (t->fdt == NULL) // 메모리 할당 실패시 에러 리턴.
 		return TID_ERROR; // -1
 
@@ -232,11 +288,10 @@ void preempt_priority(void)
 {
 	if (thread_current() == idle_thread)
 		return;
-	if (list_empty(&ready_list))
+	if (ready_mask == 0)
 		return;
 	struct thread *curr = thread_current();
-	struct thread *ready = list_entry(list_front(&ready_list), struct thread, elem);
-	if (curr->priority < ready->priority) // ready_list에 현재 실행중인 스레드보다 우선순위가 높은 스레드가 있으면
+	if (curr->priority < ready_queue_max_priority()) // ready queue에 현재 실행중인 스레드보다 우선순위가 높은 스레드가 있으면
 		thread_yield();
 }
 
@@ -270,8 +325,13 @@ void thread_unblock(struct thread *t)
 
 	old_level = intr_disable();			 // 인터럽트 비활성화 이전 인터럽트를 old_level에 저장.
 	ASSERT(t->status == THREAD_BLOCKED); // blocked 상태여야
-	// list_push_back (&ready_list, &t->elem); // t의 알람링크를 ready_list에 추가.
-	list_insert_ordered(&ready_list, &t->elem, cmp_priority, NULL);
+	if (thread_mlfqs && t != idle_thread)
+	{
+		/* block된 동안 밀린 recent_cpu 감쇠를 적용하고 우선순위 재계산 */
+		mlfqs_catch_up(t);
+		mlfqs_update_priority(t);
+	}
+	ready_queue_push(t); // t의 우선순위에 해당하는 ready queue 뒤에 추가.
 	t->status = THREAD_READY;  // 레디 상태로 설정.
 	intr_set_level(old_level); // 인터럽트 다시 활성화
 }
@@ -317,14 +377,32 @@ void thread_exit(void)
 #ifdef USERPROG
 	process_exit();
 #endif
+	/* 매거진에 쥐고 있던 블록을 malloc 디스크립터로 돌려준다. */
+	malloc_thread_exit();
 
 	/* Just set our status to dying and schedule another process.
 	   We will be destroyed during the call to schedule_tail(). */
 	intr_disable();
+	list_remove(&thread_current()->all_elem);
 	do_schedule(THREAD_DYING);
 	NOT_REACHED();
 }
 
+/* Invokes function FUNC on all threads, passing along AUX.
+   This function must be called with interrupts off. */
+void thread_foreach(thread_action_func *func, void *aux)
+{
+	struct list_elem *e;
+
+	ASSERT(intr_get_level() == INTR_OFF);
+
+	for (e = list_begin(&all_list); e != list_end(&all_list); e = list_next(e))
+	{
+		struct thread *t = list_entry(e, struct thread, all_elem);
+		func(t, aux);
+	}
+}
+
 /* Yields the CPU.  The current thread is not put to sleep and
    may be scheduled again immediately at the scheduler's whim. */
 void thread_yield(void)
@@ -336,8 +414,7 @@ void thread_yield(void)
 
 	old_level = intr_disable(); // 인터럽트를 비활성하고 이전 인터럽트의 상태를 반환
 	if (curr != idle_thread)
-		// list_push_back (&ready_list, &curr->elem); // 주어진 entry
-		list_insert_ordered(&ready_list, &curr->elem, cmp_priority, NULL);
+		ready_queue_push(curr); // 같은 우선순위 안에서는 FIFO
 	do_schedule(THREAD_READY); // 컨텍스트 스위치 작업을 수행
 	intr_set_level(old_level); // 인자로 전달된 인터럽트 상태로 인터럽트를 설정하고 이전 인터럽트 상태를 반환
 }
@@ -345,8 +422,12 @@ void thread_yield(void)
 /* Sets the current thread's priority to NEW_PRIORITY. */
 void thread_set_priority(int new_priority)
 {
+	/* MLFQS에서는 우선순위를 스케줄러가 직접 계산한다. */
+	if (thread_mlfqs)
+		return;
+
 	thread_current()->init_priority = new_priority;
-	// 현재 쓰레드의 우선순위와 ready_list에서 가장 높은 우선 순위를 비교하여 스케쥴링 하는 함수 호출
+	// 현재 쓰레드의 우선순위와 ready queue에서 가장 높은 우선 순위를 비교하여 스케쥴링 하는 함수 호출
 	refresh_priority();
 	test_max_priority();
 }
@@ -358,30 +439,127 @@ int thread_get_priority(void)
 }
 
 /* Sets the current thread's nice value to NICE. */
-void thread_set_nice(int nice UNUSED)
+void thread_set_nice(int nice)
 {
-	/* TODO: Your implementation goes here */
+	struct thread *curr = thread_current();
+	enum intr_level old_level;
+
+	ASSERT(NICE_MIN <= nice && nice <= NICE_MAX);
+
+	old_level = intr_disable();
+	curr->nice = nice;
+	/* priority 스케줄러에서는 nice가 우선순위에 영향을 주지 않는다. */
+	if (thread_mlfqs)
+		mlfqs_update_priority(curr);
+	intr_set_level(old_level);
+	if (thread_mlfqs)
+		test_max_priority();
 }
 
 /* Returns the current thread's nice value. */
 int thread_get_nice(void)
 {
-	/* TODO: Your implementation goes here */
-	return 0;
+	return thread_current()->nice;
 }
 
 /* Returns 100 times the system load average. */
 int thread_get_load_avg(void)
 {
-	/* TODO: Your implementation goes here */
-	return 0;
+	enum intr_level old_level = intr_disable();
+	int load = fp_to_int_round(mult_mixed(load_avg, 100));
+	intr_set_level(old_level);
+	return load;
 }
 
 /* Returns 100 times the current thread's recent_cpu value. */
 int thread_get_recent_cpu(void)
 {
-	/* TODO: Your implementation goes here */
-	return 0;
+	enum intr_level old_level = intr_disable();
+	int recent = fp_to_int_round(mult_mixed(thread_current()->recent_cpu, 100));
+	intr_set_level(old_level);
+	return recent;
+}
+
+/* priority = PRI_MAX - (recent_cpu / 4) - (nice * 2) */
+static void
+mlfqs_update_priority(struct thread *t)
+{
+	if (t == idle_thread)
+		return;
+
+	int priority = PRI_MAX - fp_to_int(div_mixed(t->recent_cpu, 4)) - t->nice * 2;
+	if (priority < PRI_MIN)
+		priority = PRI_MIN;
+	if (priority > PRI_MAX)
+		priority = PRI_MAX;
+	t->priority = priority;
+}
+
+/* T에 아직 적용되지 않은 초 단위 recent_cpu 감쇠를 적용한다.
+   recent_cpu = decay * recent_cpu + nice
+   DECAY_HISTORY초보다 오래 잠들어 있었다면 기록이 남아 있는 가장 오래된
+   계수로 나머지를 근사한다. */
+static void
+mlfqs_catch_up(struct thread *t)
+{
+	int64_t missed = mlfqs_epoch - t->mlfqs_epoch;
+
+	ASSERT(intr_get_level() == INTR_OFF);
+	if (missed <= 0)
+		return;
+
+	if (missed > DECAY_HISTORY)
+	{
+		int oldest = decay_history[(mlfqs_epoch + 1) % DECAY_HISTORY];
+		for (int64_t i = DECAY_HISTORY; i < missed && i < 2 * DECAY_HISTORY; i++)
+			t->recent_cpu = add_mixed(mult_fp(oldest, t->recent_cpu), t->nice);
+		missed = DECAY_HISTORY;
+	}
+	for (int64_t e = mlfqs_epoch - missed + 1; e <= mlfqs_epoch; e++)
+		t->recent_cpu = add_mixed(mult_fp(decay_history[e % DECAY_HISTORY],
+										  t->recent_cpu), t->nice);
+	t->mlfqs_epoch = mlfqs_epoch;
+}
+
+/* 1초마다 타이머 인터럽트에서 호출된다.  load_avg를 갱신하고
+   실행 중인 스레드와 ready 스레드의 recent_cpu, 우선순위를 다시
+   계산한다. */
+static void
+mlfqs_second(void)
+{
+	struct thread *curr = thread_current();
+	struct list ready;
+	int ready_threads = ready_cnt + (curr != idle_thread ? 1 : 0);
+
+	ASSERT(intr_context());
+
+	/* load_avg = (59/60) * load_avg + (1/60) * ready_threads */
+	load_avg = add_fp(div_mixed(mult_mixed(load_avg, 59), 60),
+					  div_mixed(int_to_fp(ready_threads), 60));
+
+	/* decay = (2 * load_avg) / (2 * load_avg + 1) */
+	mlfqs_epoch++;
+	decay_history[mlfqs_epoch % DECAY_HISTORY] =
+		div_fp(mult_mixed(load_avg, 2), add_mixed(mult_mixed(load_avg, 2), 1));
+
+	if (curr != idle_thread)
+	{
+		mlfqs_catch_up(curr);
+		mlfqs_update_priority(curr);
+	}
+
+	/* ready 스레드는 우선순위가 바뀌면 큐도 옮겨야 하므로 모두 꺼냈다가
+	   높은 우선순위 큐부터 원래 순서대로 다시 넣는다. */
+	list_init(&ready);
+	while (ready_mask != 0)
+		list_push_back(&ready, &ready_queue_pop()->elem);
+	while (!list_empty(&ready))
+	{
+		struct thread *t = list_entry(list_pop_front(&ready), struct thread, elem);
+		mlfqs_catch_up(t);
+		mlfqs_update_priority(t);
+		ready_queue_push(t);
+	}
 }
 
 /* Idle thread.  Executes when no other thread is ready to run.
@@ -407,6 +585,16 @@ idle(void *idle_started_ UNUSED)
 		intr_disable();
 		thread_block();
 
+		/* 할 일이 없는 동안 해제된 페이지를 미리 0으로 채워 둔다.
+		   한 페이지 채울 때마다 다시 스케줄러를 확인한다. */
+		intr_enable();
+		if (palloc_zero_idle())
+			continue;
+		intr_disable();
+
+		/* 틱리스 모드면 다음 타이머 이벤트까지 주기적인 tick을 끈다. */
+		timer_tickless_enter();
+
 		/* Re-enable interrupts and wait for the next one.
 
 		   The `sti' instruction disables interrupts until the
@@ -455,7 +643,8 @@ init_thread(struct thread *t, const char *name, int priority)
 	/* 1.4 추가한 struct 초기화 */
 	t->init_priority = priority; 	// 초기 중요도 값 설정
 	t->wait_on_lock = NULL;			// 기다리는 락은 NULL로 설정
-	list_init(&t->donations);		// 스레드의 donations를 초기화
+	t->wait_on_sema = NULL;
+	prio_set_init(&t->held);		// 받은 donation 없음
 
 	t->exit_status = 0;				/* exit status 는 0으로 초기화 */
 	t->next_fd = 2;					/* next_fd 는 2로 초기화 (0 - 표준 입력, 1 - 표춘출력) */
@@ -463,6 +652,11 @@ init_thread(struct thread *t, const char *name, int priority)
 	sema_init(&t->exit_sema, 0);	/* exit의 세마 초기화 */
 	sema_init(&t->wait_sema, 0);	/* wait의 세마 초기화 */
 	list_init(&(t->child_list));	/* child_list를 초기화(head,tail 지정) */
+	timer_event_init(&t->sleep_event, thread_wakeup, t);
+
+	enum intr_level old_level = intr_disable();
+	list_push_back(&all_list, &t->all_elem);
+	intr_set_level(old_level);
 }
 
 /* Chooses and returns the next thread to be scheduled.  Should
@@ -473,10 +667,62 @@ init_thread(struct thread *t, const char *name, int priority)
 static struct thread *
 next_thread_to_run(void)
 {
-	if (list_empty(&ready_list))
+	if (ready_mask == 0)
 		return idle_thread;
 	else
-		return list_entry(list_pop_front(&ready_list), struct thread, elem);
+		return ready_queue_pop();
+}
+
+/* T를 우선순위에 맞는 ready queue의 맨 뒤에 넣는다.
+   인터럽트가 꺼진 상태에서 호출해야 한다. */
+static void
+ready_queue_push(struct thread *t)
+{
+	ASSERT(intr_get_level() == INTR_OFF);
+	ASSERT(PRI_MIN <= t->priority && t->priority <= PRI_MAX);
+
+	list_push_back(&ready_queues[t->priority], &t->elem);
+	ready_mask |= 1ULL << t->priority;
+	ready_cnt++;
+}
+
+/* 가장 높은 우선순위 큐의 맨 앞 스레드를 꺼낸다.
+   ready queue가 비어있으면 안 된다. */
+static struct thread *
+ready_queue_pop(void)
+{
+	int pri = ready_queue_max_priority();
+	struct list *queue = &ready_queues[pri];
+	struct thread *t = list_entry(list_pop_front(queue), struct thread, elem);
+
+	if (list_empty(queue))
+		ready_mask &= ~(1ULL << pri);
+	ready_cnt--;
+	return t;
+}
+
+/* ready 상태인 스레드 중 가장 높은 우선순위를 반환한다.
+   ready queue가 비어있으면 PRI_MIN - 1. */
+static int
+ready_queue_max_priority(void)
+{
+	if (ready_mask == 0)
+		return PRI_MIN - 1;
+	return 63 - __builtin_clzll(ready_mask);
+}
+
+/* ready 상태인 스레드 T의 우선순위가 바뀌었을 때 (donation 등)
+   T를 새 우선순위의 큐로 옮긴다. */
+static void
+ready_queue_requeue(struct thread *t, int old_priority)
+{
+	ASSERT(t->status == THREAD_READY);
+
+	list_remove(&t->elem);
+	if (list_empty(&ready_queues[old_priority]))
+		ready_mask &= ~(1ULL << old_priority);
+	ready_cnt--;
+	ready_queue_push(t);
 }
 
 /* Use iretq to launch the thread */
@@ -654,76 +900,46 @@ allocate_tid(void)
 	return tid;
 }
 
+/* 현재 스레드를 TICKS 틱이 될 때까지 재운다.
+   깨우는 일은 타이머 휠에 등록한 sleep_event가 맡는다. */
 void thread_sleep(int64_t ticks)
 {
 	struct thread *curr = thread_current(); // 현재 실행 되고 있는 thread를 반환
 	enum intr_level old_level;
 
 	ASSERT(!intr_context());
+	ASSERT(curr != idle_thread);
 
 	old_level = intr_disable(); // 인터럽트를 비활성하고 이전 인터럽트의 상태를 반환
-	if (curr != idle_thread)
-		curr->wakeup_tick = ticks;
-	list_push_back(&sleep_list, &curr->elem); // 주어진 entry
-	update_next_tick_to_awake(ticks);
+	curr->wakeup_tick = ticks;
+	timer_event_add(&curr->sleep_event, ticks);
 	thread_block();
-	// do_schedule (THREAD_BLOCKED); // 컨텍스트 스위치 작업을 수행
 	intr_set_level(old_level); // 인자로 전달된 인터럽트 상태로 인터럽트를 설정하고 이전 인터럽트 상태를 반환
 }
 
-void thread_awake(int64_t ticks)
+/* sleep_event 만료 시 타이머 인터럽트에서 호출된다.
+   깨운 스레드가 더 높은 우선순위면 인터럽트 리턴 시 양보한다. */
+static void
+thread_wakeup(void *t_)
 {
-	struct list_elem *cur_elem;
-	enum intr_level old_level;
-	int64_t tmp_tick = INT64_MAX;
+	struct thread *t = t_;
 
-	cur_elem = list_begin(&sleep_list);
-
-	while (cur_elem != list_end(&sleep_list))
-	{
-		struct thread *curr = list_entry(cur_elem, struct thread, elem);
-		if (curr->wakeup_tick <= ticks)
-		{
-			cur_elem = list_remove(cur_elem);
-			thread_unblock(curr);
-		}
-		else
-		{
-			if (tmp_tick > curr->wakeup_tick)
-			{
-				tmp_tick = curr->wakeup_tick;
-			}
-			cur_elem = list_next(cur_elem);
-		}
-	}
-	next_tick_to_awake = tmp_tick;
-}
-
-void update_next_tick_to_awake(int64_t ticks)
-{
-	if (next_tick_to_awake > ticks)
-	{
-		next_tick_to_awake = ticks;
-	}
-}
+	ASSERT(intr_context());
 
-int64_t get_next_tick_to_awake(void)
-{
-	return next_tick_to_awake;
+	thread_unblock(t);
+	if (thread_current() != idle_thread && t->priority > thread_current()->priority)
+		intr_yield_on_return();
 }
 
 void test_max_priority(void)
 {
-	struct list_elem *cur_elem;
-	cur_elem = list_begin(&ready_list);
-	struct thread *thr = list_entry(cur_elem, struct thread, elem);
-
-	if (!list_empty(&ready_list))
+	if (thread_current()->priority < ready_queue_max_priority())
 	{
-		if (thread_current()->priority < thr->priority)
-		{
+		/* sema_up()은 인터럽트 핸들러에서도 불리므로 그때는 리턴 시점에 양보 */
+		if (intr_context())
+			intr_yield_on_return();
+		else
 			thread_yield();
-		}
 	}
 }
 
@@ -739,52 +955,98 @@ bool cmp_priority(const struct list_elem *a_, const struct list_elem *b_, void *
 	return 0;
 }
 
-/* --- Project 1-4. Priority donation --- */
-void donate_priority(void)
+/* --- Project 1-4. Priority donation ---
+   lock은 자기를 기다리는 스레드들의 우선순위를 prio_set으로, 스레드는
+   자기가 가진 lock마다 그 lock의 최고 waiter 우선순위를 prio_set으로
+   들고 있다.  effective priority는 init_priority와 held의 최댓값 중
+   큰 값이고, 바뀌면 wait_on_lock 체인을 따라 바뀐 만큼만 전파한다.
+   모두 인터럽트가 꺼진 상태에서 다룬다. */
+
+/* LOCK의 최고 waiter 우선순위가 OLD_MAX에서 바뀌었으면 holder의 held에
+   반영하고 holder를 반환한다.  전파할 필요가 없으면 NULL. */
+static struct thread *
+lock_waiters_changed(struct lock *lock, int old_max)
 {
-	int cnt = 0;
-	struct thread *t = thread_current();
-	int cur_priority = t->priority;
+	int new_max = prio_set_max(&lock->waiters);
+	struct thread *holder = lock->holder;
+
+	if (new_max == old_max || holder == NULL)
+		return NULL;
+	if (old_max >= 0)
+		prio_set_remove(&holder->held, old_max);
+	if (new_max >= 0)
+		prio_set_add(&holder->held, new_max);
+	return holder;
+}
+
+/* T의 effective priority를 다시 계산하고, 바뀌었으면 T가 들어있는
+   큐의 위치와 T가 기다리는 lock의 holder들에게 차례로 반영한다. */
+static void
+update_priority(struct thread *t)
+{
+	ASSERT(intr_get_level() == INTR_OFF);
 
-	while (cnt < 9)
+	while (t != NULL)
 	{
-		cnt++;
-		if (t->wait_on_lock == NULL) {
-			break;
+		int old_priority = t->priority;
+		int new_priority = prio_set_max(&t->held);
+
+		if (new_priority < t->init_priority)
+			new_priority = t->init_priority;
+		if (new_priority == old_priority)
+			return;
+		t->priority = new_priority;
+
+		if (t->status == THREAD_READY)
+			ready_queue_requeue(t, old_priority);
+		else if (t->status == THREAD_BLOCKED && t->wait_on_sema != NULL)
+		{
+			/* semaphore waiters는 우선순위 순서를 유지한다. */
+			list_remove(&t->elem);
+			list_insert_ordered(&t->wait_on_sema->waiters, &t->elem, cmp_priority, NULL);
 		}
-		t = t->wait_on_lock->holder;
-		t->priority = cur_priority;
+
+		struct lock *lock = t->wait_on_lock;
+		if (lock == NULL)
+			return;
+		int old_max = prio_set_max(&lock->waiters);
+		prio_set_remove(&lock->waiters, old_priority);
+		prio_set_add(&lock->waiters, new_priority);
+		t = lock_waiters_changed(lock, old_max);
 	}
 }
 
-void remove_with_lock(struct lock *lock) {
+/* 현재 스레드가 wait_on_lock을 기다리기 시작한다.
+   lock의 waiter로 등록하고 holder에게 우선순위를 donation 한다. */
+void donate_priority(void)
+{
 	struct thread *cur = thread_current();
-	struct list_elem *e;
-	
-	for (e= list_begin(&cur->donations); e != list_end(&cur->donations);e = list_next(e)){
-		struct thread *t = list_entry(e, struct thread, donation_elem);
-		if (t->wait_on_lock == lock) {
-			list_remove(&t->donation_elem);
-		}
-	}
+	struct lock *lock = cur->wait_on_lock;
+	enum intr_level old_level = intr_disable(); // ready queue를 건드릴 수 있으므로
+
+	ASSERT(lock != NULL);
+
+	int old_max = prio_set_max(&lock->waiters);
+	prio_set_add(&lock->waiters, cur->priority);
+	update_priority(lock_waiters_changed(lock, old_max));
+	intr_set_level(old_level);
 }
 
-void refresh_priority(void) {
+/* 현재 스레드가 LOCK을 놓으면서 LOCK의 waiter들에게 받은 donation을 뺀다. */
+void remove_with_lock(struct lock *lock) {
 	struct thread *cur = thread_current();
-	cur->priority = cur->init_priority;
+	enum intr_level old_level = intr_disable();
+	int max = prio_set_max(&lock->waiters);
 
-	if (!list_empty(&cur->donations)) {
-		list_sort(&cur->donations, thread_compare_donate_priority, 0);
-		struct thread *front = list_entry (list_front(&cur->donations), struct thread, donation_elem);
-		if (front->priority > cur->priority)
-		{
-			cur->priority = front->priority;
-		}
-	}
+	if (max >= 0)
+		prio_set_remove(&cur->held, max);
+	intr_set_level(old_level);
 }
 
-/* --- project 1.4 --- */ 
-bool thread_compare_donate_priority(const struct list_elem *l, const struct list_elem *s, void *aux) {
+/* 현재 스레드의 effective priority를 다시 계산한다. */
+void refresh_priority(void) {
+	enum intr_level old_level = intr_disable();
 
-	return list_entry (l, struct thread, donation_elem)->priority > list_entry (s, struct thread, donation_elem)->priority;
-}
\ No newline at end of file
+	update_priority(thread_current());
+	intr_set_level(old_level);
+}
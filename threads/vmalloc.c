@@ -0,0 +1,148 @@
+#include "threads/vmalloc.h"
+#include <bitmap.h>
+#include <debug.h>
+#include <round.h>
+#include <stdint.h>
+#include "threads/init.h"
+#include "threads/mmu.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
+
+/* Kernel virtual allocator.
+
+   palloc_get_multiple() needs physically contiguous pages, which
+   may not exist once memory is fragmented even if plenty is free.
+   vmalloc() instead takes single pages from the kernel pool and
+   maps them side by side in a kernel virtual region of their own,
+   outside the direct map.
+
+   The region is one PML4 slot.  vmalloc_init() creates its table
+   in base_pml4 before any process exists, so every pml4 copied
+   from base_pml4 shares it and sees every later mapping.
+
+   used_map tracks which pages of the region are reserved and
+   end_map marks the last page of each area, which is how vfree()
+   finds an area's size.  Each area is followed by an unmapped
+   guard page, so running off its end faults. */
+
+/* Start and size of the region: PML4 slot 2, 256 MB. */
+#define VMALLOC_START ((uint8_t *) 0x10000000000)
+#define VMALLOC_PAGES ((size_t) 1 << 16)
+
+static struct bitmap *used_map;     /* Reserved pages, guards included. */
+static struct bitmap *end_map;      /* Last page of each area. */
+static struct spinlock vmalloc_lock; /* Protects the maps and page tables. */
+
+/* Initializes the kernel virtual allocator.  Must be called
+   after paging_init() and before any pml4 is created. */
+void
+vmalloc_init (void) {
+	used_map = bitmap_create (VMALLOC_PAGES);
+	end_map = bitmap_create (VMALLOC_PAGES);
+	if (used_map == NULL || end_map == NULL)
+		PANIC ("vmalloc_init: out of memory");
+	spinlock_init (&vmalloc_lock);
+
+	if (pml4e_walk (base_pml4, (uint64_t) VMALLOC_START, 1) == NULL)
+		PANIC ("vmalloc_init: out of memory");
+}
+
+/* Returns true if P points into the vmalloc region. */
+bool
+is_vmalloc_addr (const void *p) {
+	const uint8_t *va = p;
+	return va >= VMALLOC_START && va < VMALLOC_START + VMALLOC_PAGES * PGSIZE;
+}
+
+/* Allocates SIZE bytes of virtually contiguous memory, getting
+   each page with palloc_get_page (FLAGS). */
+static void *
+vmalloc_pages (size_t size, enum palloc_flags flags) {
+	size_t page_cnt = DIV_ROUND_UP (size, PGSIZE);
+	enum intr_level old_level;
+	uint8_t *area;
+	size_t idx;
+
+	ASSERT (used_map != NULL);
+	if (size == 0)
+		return NULL;
+
+	/* Reserve the area and its guard page. */
+	old_level = spin_lock_irqsave (&vmalloc_lock);
+	idx = bitmap_scan_hint (used_map, page_cnt + 1, false);
+	if (idx != BITMAP_ERROR) {
+		bitmap_set_multiple (used_map, idx, page_cnt + 1, true);
+		bitmap_mark (end_map, idx + page_cnt - 1);
+	}
+	spin_unlock_irqrestore (&vmalloc_lock, old_level);
+	if (idx == BITMAP_ERROR)
+		return NULL;
+	area = VMALLOC_START + idx * PGSIZE;
+
+	/* Back it with pages. */
+	for (size_t i = 0; i < page_cnt; i++) {
+		void *kpage = palloc_get_page (flags);
+		bool success = false;
+
+		if (kpage != NULL) {
+			old_level = spin_lock_irqsave (&vmalloc_lock);
+			success = pml4_map_kernel_page (area + i * PGSIZE, kpage);
+			spin_unlock_irqrestore (&vmalloc_lock, old_level);
+		}
+		if (!success) {
+			palloc_free_page (kpage);
+			vfree (area);
+			return NULL;
+		}
+	}
+	return area;
+}
+
+/* Obtains and returns SIZE bytes of kernel memory that is
+   contiguous in virtual memory only.  Returns a null pointer if
+   memory or address space is not available. */
+void *
+vmalloc (size_t size) {
+	return vmalloc_pages (size, 0);
+}
+
+/* Like vmalloc(), but the memory is filled with zeros. */
+void *
+vzalloc (size_t size) {
+	return vmalloc_pages (size, PAL_ZERO);
+}
+
+/* Frees P, which must have been returned by vmalloc() or
+   vzalloc(). */
+void
+vfree (void *p) {
+	enum intr_level old_level;
+	size_t idx, last;
+
+	if (p == NULL)
+		return;
+	ASSERT (is_vmalloc_addr (p));
+	ASSERT (pg_ofs (p) == 0);
+
+	idx = ((uint8_t *) p - VMALLOC_START) / PGSIZE;
+	old_level = spin_lock_irqsave (&vmalloc_lock);
+	ASSERT (bitmap_test (used_map, idx));
+	last = bitmap_scan (end_map, idx, 1, true);
+	ASSERT (last != BITMAP_ERROR);
+	spin_unlock_irqrestore (&vmalloc_lock, old_level);
+
+	for (size_t i = idx; i <= last; i++) {
+		void *kpage;
+
+		old_level = spin_lock_irqsave (&vmalloc_lock);
+		kpage = pml4_unmap_kernel_page (VMALLOC_START + i * PGSIZE);
+		spin_unlock_irqrestore (&vmalloc_lock, old_level);
+		palloc_free_page (kpage);
+	}
+
+	old_level = spin_lock_irqsave (&vmalloc_lock);
+	bitmap_reset (end_map, last);
+	bitmap_set_multiple (used_map, idx, last - idx + 2, false);
+	spin_unlock_irqrestore (&vmalloc_lock, old_level);
+}
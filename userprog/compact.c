@@ -0,0 +1,245 @@
+#include "userprog/compact.h"
+#include <debug.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "devices/timer.h"
+#include "threads/interrupt.h"
+#include "threads/mmu.h"
+#include "threads/palloc.h"
+#include "threads/pte.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+
+/* Memory compaction.
+
+   The "compactd" thread wakes up once a second and asks palloc
+   whether the user pool is too fragmented for multi-page
+   allocations.  If so, it picks a 2 MB block with few pages in
+   use and moves each of them to a free page elsewhere: copy the
+   contents, then point the user mapping at the new frame.  Once
+   the block is empty, it is freed as a whole.
+
+   There is no frame table to say who maps a frame, so the
+   reverse map is built by walking the page table of every
+   process.  A block can be moved only if every page in use in it
+   turns up there exactly once, as a 4 kB user page.  Anything
+   else (a page table, a page being loaded, a huge page) pins the
+   block, and it is left alone.
+
+   With VM, the frame table also records each frame's kernel
+   address, so a page must also be found in its owner's
+   supplemental page table, and its frame's address is updated
+   after the move.
+
+   compactd holds migrate_lock for writing while it works on a
+   block.  Code that changes a user page table, frees a user page,
+   or reaches a user frame through its kernel address and may
+   sleep in between must hold migrate_lock for reading, so none of
+   that happens meanwhile.  Interrupts are turned off only to list
+   the processes and to switch each PTE to its new frame.  User
+   code may still run while a page is copied.  It is copied again
+   if its dirty bit shows that it was written in the meantime. */
+
+/* 커널 주소로 user frame을 다루는 동안 읽기로 잡는다. */
+struct rwlock migrate_lock;
+
+/* Reverse map entry: where a page of the block is mapped. */
+struct rmap {
+	uint64_t *pml4;             /* Page map, or null if not found. */
+	void *upage;                /* User virtual page. */
+#ifdef VM
+	struct frame *frame;        /* Frame table entry. */
+#endif
+};
+
+/* A process whose page map is walked. */
+struct rmap_proc {
+	struct thread *thread;
+	uint64_t *pml4;
+};
+
+#define RMAP_PROCS 256
+
+/* State for building the reverse map of one block. */
+struct rmap_walk {
+	uint8_t *block;             /* Block being compacted. */
+	struct rmap_proc procs[RMAP_PROCS]; /* Processes to walk. */
+	size_t proc_cnt;            /* Entries in procs. */
+	struct thread *thread;      /* Thread whose page map is walked. */
+	uint64_t *pml4;             /* Page map being walked. */
+	struct rmap map[HPG_PAGES]; /* Indexed by page within block. */
+	size_t found;               /* Entries filled in. */
+	bool pinned;                /* Block cannot be moved. */
+};
+
+/* Too big for compactd's stack. */
+static struct rmap_walk walk;
+
+static void compactd (void *aux);
+static bool compact_block (void *block);
+
+/* Initializes compaction and starts the compaction thread. */
+void
+compact_init (void) {
+	rwlock_init (&migrate_lock);
+	thread_create ("compactd", PRI_MIN, compactd, NULL);
+}
+
+/* Compaction thread. */
+static void
+compactd (void *aux UNUSED) {
+	size_t cursor = 0;
+
+	for (;;) {
+		void *block;
+
+		timer_sleep (TIMER_FREQ);
+		if (!palloc_compact_needed ())
+			continue;
+
+		rwlock_acquire_write (&migrate_lock);
+		block = palloc_compact_target (&cursor);
+		if (block != NULL)
+			compact_block (block);
+		rwlock_release_write (&migrate_lock);
+	}
+}
+
+/* pml4_for_each() callback: records in the reverse map where the
+   pages of the block are mapped. */
+static bool
+rmap_add (uint64_t *pte, void *va, void *aux UNUSED) {
+	uint8_t *kpage = ptov (PTE_ADDR (*pte));
+	size_t idx;
+
+	if (!is_user_vaddr (va))
+		return true;
+	if (is_huge_pte (pte)) {
+		if (kpage < walk.block + HPGSIZE && kpage + HPGSIZE > walk.block)
+			walk.pinned = true;
+		return !walk.pinned;
+	}
+	if (kpage < walk.block || kpage >= walk.block + HPGSIZE)
+		return true;
+
+	idx = pg_no (kpage) - pg_no (walk.block);
+	if (walk.map[idx].pml4 != NULL) {
+		/* 두 곳 이상에서 매핑된 frame은 옮기지 않는다. */
+		walk.pinned = true;
+		return false;
+	}
+#ifdef VM
+	{
+		struct page *page = spt_find_page (&walk.thread->spt, va);
+
+		/* 올리거나 내보내는 중인 frame은 건드리지 않는다. */
+		if (page == NULL || page->frame == NULL
+				|| page->frame->kva != kpage) {
+			walk.pinned = true;
+			return false;
+		}
+		walk.map[idx].frame = page->frame;
+	}
+#endif
+	walk.map[idx].pml4 = walk.pml4;
+	walk.map[idx].upage = va;
+	walk.found++;
+	return true;
+}
+
+/* thread_foreach() callback: remembers T if it has a page map.
+   프로세스가 너무 많으면 이번에는 옮기지 않는다. */
+static void
+rmap_thread (struct thread *t, void *aux UNUSED) {
+	if (t->pml4 == NULL)
+		return;
+	if (walk.proc_cnt == RMAP_PROCS) {
+		walk.pinned = true;
+		return;
+	}
+	walk.procs[walk.proc_cnt].thread = t;
+	walk.procs[walk.proc_cnt].pml4 = t->pml4;
+	walk.proc_cnt++;
+}
+
+/* Moves the page of R from OLD to NEW.  The page is copied with
+   interrupts on.  Only the final check of the dirty bit and the
+   PTE switch run with interrupts off. */
+static void
+move_page (struct rmap *r, const void *old, void *new) {
+	enum intr_level old_level;
+	bool dirty;
+
+	/* 복사하는 동안 프로세스가 쓰면 dirty bit이 다시 켜진다.
+	   원래 값은 옮긴 뒤에 되돌린다. */
+	dirty = pml4_is_dirty (r->pml4, r->upage);
+	pml4_set_dirty (r->pml4, r->upage, false);
+	memcpy (new, old, PGSIZE);
+
+	old_level = intr_disable ();
+	if (pml4_is_dirty (r->pml4, r->upage)) {
+		memcpy (new, old, PGSIZE);
+		dirty = true;
+	}
+	if (!pml4_remap_page (r->pml4, r->upage, new))
+		NOT_REACHED ();
+	if (dirty)
+		pml4_set_dirty (r->pml4, r->upage, true);
+#ifdef VM
+	r->frame->kva = new;
+#endif
+	intr_set_level (old_level);
+}
+
+/* Tries to empty the 2 MB block at BLOCK by moving every page in
+   it to another frame.  Returns true if successful.  migrate_lock
+   must be held for writing. */
+static bool
+compact_block (void *block) {
+	enum intr_level old_level;
+	size_t used = palloc_compact_begin (block);
+	size_t moved = 0;
+	bool success;
+
+	memset (&walk, 0, sizeof walk);
+	walk.block = block;
+
+	/* 프로세스 목록만 인터럽트를 끄고 훑는다.  page map은
+	   migrate_lock 덕분에 그 뒤에도 해제되지 않는다. */
+	old_level = intr_disable ();
+	thread_foreach (rmap_thread, NULL);
+	intr_set_level (old_level);
+	for (size_t i = 0; i < walk.proc_cnt && !walk.pinned; i++) {
+		walk.thread = walk.procs[i].thread;
+		walk.pml4 = walk.procs[i].pml4;
+		pml4_for_each (walk.pml4, rmap_add, NULL);
+	}
+	success = !walk.pinned && walk.found == used;
+
+	for (size_t i = 0; success && i < HPG_PAGES; i++) {
+		struct rmap *r = &walk.map[i];
+		void *new;
+
+		if (r->pml4 == NULL)
+			continue;
+		new = palloc_get_page (PAL_USER);
+		if (new == NULL) {
+			success = false;
+			break;
+		}
+		move_page (r, walk.block + PGSIZE * i, new);
+		moved++;
+	}
+
+	palloc_compact_end (block, success);
+	if (!success && moved > 0) {
+		/* 이미 옮긴 page의 원래 frame은 이제 아무도 쓰지 않는다. */
+		for (size_t i = 0; moved > 0; i++)
+			if (walk.map[i].pml4 != NULL) {
+				palloc_free_page (walk.block + PGSIZE * i);
+				moved--;
+			}
+	}
+	return success;
+}
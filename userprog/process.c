@@ -7,16 +7,19 @@
 #include <string.h>
 #include "userprog/gdt.h"
 #include "userprog/tss.h"
+#include "userprog/compact.h"
 #include "filesys/directory.h"
 #include "filesys/file.h"
 #include "filesys/filesys.h"
 #include "threads/flags.h"
 #include "threads/init.h"
 #include "threads/interrupt.h"
+#include "threads/malloc.h"
 #include "threads/palloc.h"
 #include "threads/thread.h"
 #include "threads/mmu.h"
 #include "threads/vaddr.h"
+#include "threads/vmalloc.h"
 #include "intrinsic.h"
 #ifdef VM
 #include "vm/vm.h"
@@ -112,45 +115,120 @@ process_fork (const char *name, struct intr_frame *if_ UNUSED)
 }
 
 #ifndef VM
+/* huge page 하나를 자식에게 복사한다.  2MB를 연속으로 얻지 못하면
+ * 4KB 페이지 512개로 나누어 복사한다. */
+static bool
+duplicate_huge_pte (uint64_t *pte, void *va, struct thread *parent) {
+	struct thread *current = thread_current ();
+	uint8_t *parent_page = pml4_get_page (parent->pml4, va);
+	bool writable = is_writable (pte);
+	uint8_t *newpage;
+
+	newpage = palloc_get_huge_page (PAL_USER);
+	if (newpage != NULL) {
+		memcpy (newpage, parent_page, HPGSIZE);
+		if (pml4_set_huge_page (current->pml4, va, newpage, writable))
+			return true;
+		palloc_free_huge_page (newpage);
+	}
+
+	for (size_t i = 0; i < HPG_PAGES; i++) {
+		newpage = palloc_get_page (PAL_USER);
+		if (newpage == NULL)
+			return false;
+		memcpy (newpage, parent_page + i * PGSIZE, PGSIZE);
+		if (!pml4_set_page (current->pml4, (uint8_t *) va + i * PGSIZE,
+				newpage, writable)) {
+			palloc_free_page (newpage);
+			return false;
+		}
+	}
+	return true;
+}
+
+/* 부모 주소 공간에서 연속되고 권한이 같은 4KB 페이지들의 묶음.
+ * 한 page table(2MB)을 넘지 않는다. */
+struct dup_run {
+	struct thread *parent;
+	uint8_t *va;						/* 첫 페이지 주소 */
+	size_t cnt;							/* 페이지 수 */
+	bool writable;
+};
+
+/* RUN에 모인 페이지들을 자식에게 복사한다.  가능하면 연속된 물리
+ * 페이지를 한 번에 얻어 pml4_map_range()로 한꺼번에 매핑한다. */
+static bool
+dup_run_flush (struct dup_run *run) {
+	struct thread *current = thread_current ();
+	size_t cnt = run->cnt;
+	uint8_t *newpages;
+
+	run->cnt = 0;
+	if (cnt == 0)
+		return true;
+
+	newpages = palloc_get_multiple (PAL_USER, cnt);
+	if (newpages != NULL) {
+		for (size_t i = 0; i < cnt; i++)
+			memcpy (newpages + i * PGSIZE,
+					pml4_get_page (run->parent->pml4, run->va + i * PGSIZE), PGSIZE);
+		if (pml4_map_range (current->pml4, run->va, newpages, cnt, run->writable))
+			return true;
+		palloc_free_multiple (newpages, cnt);
+		return false;
+	}
+
+	/* 연속된 메모리가 없으면 한 페이지씩. */
+	for (size_t i = 0; i < cnt; i++) {
+		uint8_t *newpage = palloc_get_page (PAL_USER);
+		if (newpage == NULL)
+			return false;
+		memcpy (newpage, pml4_get_page (run->parent->pml4, run->va + i * PGSIZE),
+				PGSIZE);
+		if (!pml4_set_page (current->pml4, run->va + i * PGSIZE, newpage,
+				run->writable)) {
+			palloc_free_page (newpage);
+			return false;
+		}
+	}
+	return true;
+}
+
 /* Duplicate the parent's address space by passing this function to the
- * pml4_for_each. This is only for the project 2. */
+ * pml4_for_each. This is only for the project 2.
+ * 페이지를 바로 복사하지 않고 AUX의 dup_run에 모았다가, 묶음이 끊기면
+ * dup_run_flush()로 한꺼번에 복사한다. */
 static bool
 duplicate_pte (uint64_t *pte, void *va, void *aux) {
-	struct thread *current = thread_current ();
-	struct thread *parent = (struct thread *) aux;
-	void *parent_page;
-	void *newpage;
+	struct dup_run *run = aux;
+	struct thread *parent = run->parent;
 	bool writable;
 
-	//모름
-	/* 1. TODO: If the parent_page is kernel page, then return immediately. */
+	/* 1. If the parent_page is kernel page, then return immediately. */
 	if (is_kernel_vaddr(va))
 		return true;
 
 	/* 2. Resolve VA from the parent's page map level 4. */
-	parent_page = pml4_get_page(parent->pml4, va);
-	if (parent_page == NULL)
+	if (pml4_get_page(parent->pml4, va) == NULL)
 		return false;
 
+	if (is_huge_pte(pte))
+		return dup_run_flush(run) && duplicate_huge_pte(pte, va, parent);
 
-	/* 3. TODO: Allocate new PAL_USER page for the child and set result to
-	 *    TODO: NEWPAGE. */
-	newpage = palloc_get_page(PAL_USER | PAL_ZERO);
-	if (newpage == NULL)
-		return false;
-
-	/* 4. TODO: Duplicate parent's page to the new page and
-	 *    TODO: check whether parent's page is writable or not (set WRITABLE
-	 *    TODO: according to the result). */
-	memcpy(newpage, parent_page, PGSIZE);
+	/* 3. 이어지지 않거나 권한이 다르거나 새 page table이면 묶음을 끊는다. */
 	writable = is_writable(pte);
+	if (run->cnt > 0
+			&& ((uint8_t *) va != run->va + run->cnt * PGSIZE
+				|| writable != run->writable || hpg_ofs(va) == 0))
+		if (!dup_run_flush(run))
+			return false;
 
-	/* 5. Add new page to child's page table at address VA with WRITABLE
-	 *    permission. */
-	if (!pml4_set_page (current->pml4, va, newpage, writable)) {
-		/* 6. TODO: if fail to insert page, do error handling. */
-		return false;
+	/* 4. 묶음에 추가. */
+	if (run->cnt == 0) {
+		run->va = va;
+		run->writable = writable;
 	}
+	run->cnt++;
 	return true;
 }
 #endif
@@ -183,7 +261,13 @@ __do_fork (void *aux) {
 	if (!supplemental_page_table_copy (&current->spt, &parent->spt))
 		goto error;
 #else
-	if (!pml4_for_each (parent->pml4, duplicate_pte, parent))
+	/* 부모 frame을 커널 주소로 복사하므로 그동안 compaction을 막는다. */
+	struct dup_run run = { .parent = parent, .cnt = 0 };
+	rwlock_acquire_read (&migrate_lock);
+	succ = pml4_for_each (parent->pml4, duplicate_pte, &run)
+		&& dup_run_flush (&run);
+	rwlock_release_read (&migrate_lock);
+	if (!succ)
 		goto error;
 #endif
 
@@ -249,7 +333,14 @@ process_exec (void *f_name) {
     }
 
     /* And then load the binary */
+#ifdef VM
     success = load(file_name, &_if);
+#else
+	/* page table을 만들고 채우는 동안 compaction을 막는다. */
+	rwlock_acquire_read (&migrate_lock);
+    success = load(file_name, &_if);
+	rwlock_release_read (&migrate_lock);
+#endif
 
     /* If load failed, quit. */
     if (!success)
@@ -315,9 +406,15 @@ process_exit (void) {
 		if (curr->fdt[i] != NULL)				/* 현재 프로세스가 null 이 아니면 닫기. 변경요망(파일 디스크립터의 최소값인 2가 될 때까지 파일을 닫음)*/
 			close(i); 								
 	}
-	palloc_free_multiple(curr->fdt, FDT_PAGES); /* 파일 테이블  */
+	vfree(curr->fdt); /* 파일 테이블  */
 	file_close(curr->running); 					/* 현재 실행 중인 파일도 닫는다. */
 
+	/* 주소 공간을 정리하면 page table이 줄어드므로 그 전에 센다.
+	   page table 전체를 훑으므로 -pt-stats일 때만 한다. */
+	if (pt_stats && curr->pml4 != NULL)
+		printf ("%s: %zu page-table pages\n", curr->name,
+		        pml4_table_pages (curr->pml4));
+
 	process_cleanup ();
 
 	sema_up(&curr->wait_sema); 					/* 자식이 종료될 때까지 대기하고 있는 부모에게 signal을 보낸다. */
@@ -345,9 +442,12 @@ process_cleanup (void) {
 		 * directory before destroying the process's page
 		 * directory, or our active page directory will be one
 		 * that's been freed (and cleared). */
+		/* compaction이 이 page table을 훑고 있을 수 있다. */
+		rwlock_acquire_read (&migrate_lock);
 		curr->pml4 = NULL;
 		pml4_activate (NULL);
 		pml4_destroy (pml4);
+		rwlock_release_read (&migrate_lock);
 	}
 }
 
@@ -585,6 +685,9 @@ validate_segment (const struct Phdr *phdr, struct file *file) {
 
 /* load() helpers. */
 static bool install_page (void *upage, void *kpage, bool writable);
+static bool install_huge_page (void *upage, void *kpage, bool writable);
+static bool install_pages (void *upage, void *kpage, size_t cnt,
+		bool writable);
 
 /* Loads a segment starting at offset OFS in FILE at address
  * UPAGE.  In total, READ_BYTES + ZERO_BYTES bytes of virtual
@@ -609,35 +712,72 @@ load_segment (struct file *file, off_t ofs, uint8_t *upage,
 
 	file_seek (file, ofs);
 	while (read_bytes > 0 || zero_bytes > 0) {
-		/* Do calculate how to fill this page.
-		 * We will read PAGE_READ_BYTES bytes from FILE
-		 * and zero the final PAGE_ZERO_BYTES bytes. */
-		size_t page_read_bytes = read_bytes < PGSIZE ? read_bytes : PGSIZE;
-		size_t page_zero_bytes = PGSIZE - page_read_bytes;
+		/* 2MB 정렬된 곳에서 2MB 이상 남았으면 huge page 하나로 적재한다.
+		 * 연속 2MB를 얻지 못하거나 매핑할 수 없으면 4KB 페이지로 진행. */
+		if (hpg_ofs (upage) == 0 && read_bytes + zero_bytes >= HPGSIZE) {
+			uint8_t *kpage = palloc_get_huge_page (PAL_USER);
+			if (kpage != NULL) {
+				size_t hpage_read_bytes = read_bytes < HPGSIZE ? read_bytes : HPGSIZE;
+				off_t pos = file_tell (file);
+
+				if (file_read (file, kpage, hpage_read_bytes) != (int) hpage_read_bytes) {
+					palloc_free_huge_page (kpage);
+					return false;
+				}
+				memset (kpage + hpage_read_bytes, 0, HPGSIZE - hpage_read_bytes);
+				if (install_huge_page (upage, kpage, writable)) {
+					read_bytes -= hpage_read_bytes;
+					zero_bytes -= HPGSIZE - hpage_read_bytes;
+					upage += HPGSIZE;
+					continue;
+				}
+				palloc_free_huge_page (kpage);
+				file_seek (file, pos);
+			}
+		}
 
-		/* Get a page of memory. */
-		uint8_t *kpage = palloc_get_page (PAL_USER);
-		if (kpage == NULL)
-			return false;
+		/* 다음 2MB 경계(또는 segment 끝)까지를 연속된 페이지로 한 번에
+		 * 읽고 pml4_map_range()로 매핑한다.  연속으로 얻지 못하면
+		 * 한 페이지씩. */
+		size_t page_cnt = (read_bytes + zero_bytes) / PGSIZE;
+		size_t hpage_left = (HPGSIZE - hpg_ofs (upage)) / PGSIZE;
+		if (page_cnt > hpage_left)
+			page_cnt = hpage_left;
+
+		/* Get pages of memory. */
+		uint8_t *kpage = palloc_get_multiple (PAL_USER, page_cnt);
+		if (kpage == NULL) {
+			page_cnt = 1;
+			kpage = palloc_get_page (PAL_USER);
+			if (kpage == NULL)
+				return false;
+		}
 
-		/* Load this page. */
-		if (file_read (file, kpage, page_read_bytes) != (int) page_read_bytes) {
-			palloc_free_page (kpage);
+		/* Do calculate how to fill these pages.
+		 * We will read CHUNK_READ_BYTES bytes from FILE
+		 * and zero the final CHUNK_ZERO_BYTES bytes. */
+		size_t chunk_bytes = page_cnt * PGSIZE;
+		size_t chunk_read_bytes = read_bytes < chunk_bytes ? read_bytes : chunk_bytes;
+		size_t chunk_zero_bytes = chunk_bytes - chunk_read_bytes;
+
+		/* Load these pages. */
+		if (file_read (file, kpage, chunk_read_bytes) != (int) chunk_read_bytes) {
+			palloc_free_multiple (kpage, page_cnt);
 			return false;
 		}
-		memset (kpage + page_read_bytes, 0, page_zero_bytes);
+		memset (kpage + chunk_read_bytes, 0, chunk_zero_bytes);
 
-		/* Add the page to the process's address space. */
-		if (!install_page (upage, kpage, writable)) {
+		/* Add the pages to the process's address space. */
+		if (!install_pages (upage, kpage, page_cnt, writable)) {
 			printf("fail\n");
-			palloc_free_page (kpage);
+			palloc_free_multiple (kpage, page_cnt);
 			return false;
 		}
 
 		/* Advance. */
-		read_bytes -= page_read_bytes;
-		zero_bytes -= page_zero_bytes;
-		upage += PGSIZE;
+		read_bytes -= chunk_read_bytes;
+		zero_bytes -= chunk_zero_bytes;
+		upage += chunk_bytes;
 	}
 	return true;
 }
@@ -677,7 +817,36 @@ install_page (void *upage, void *kpage, bool writable) {
 	return (pml4_get_page (t->pml4, upage) == NULL
 			&& pml4_set_page (t->pml4, upage, kpage, writable));
 }
+
+/* install_page()의 여러 페이지 버전.  UPAGE부터 CNT개의 페이지를
+ * 물리적으로 연속된 KPAGE부터의 페이지들에 매핑한다.  그중 하나라도
+ * 이미 매핑되어 있으면 실패한다. */
+static bool
+install_pages (void *upage, void *kpage, size_t cnt, bool writable) {
+	struct thread *t = thread_current ();
+
+	return pml4_map_range (t->pml4, upage, kpage, cnt, writable);
+}
+
+/* install_page()의 huge page 버전.  UPAGE부터 2MB 안에 이미 page
+ * table이 있으면 실패한다. */
+static bool
+install_huge_page (void *upage, void *kpage, bool writable) {
+	struct thread *t = thread_current ();
+
+	return pml4_set_huge_page (t->pml4, upage, kpage, writable);
+}
 #else
+/* lazy_load_segment()에 넘기는 정보.  page마다 하나씩 malloc()하고,
+   읽고 나면 lazy_load_segment()가, 끝내 읽지 않으면 uninit_destroy()가
+   해제한다. */
+struct segment_aux {
+	struct file *file;          /* 읽을 파일. */
+	off_t ofs;                  /* 파일 안의 위치. */
+	size_t read_bytes;          /* 읽을 바이트 수.  나머지는 0. */
+	const uint8_t *ahead;       /* 미리 읽어 둔 내용, 없으면 NULL. */
+};
+
 /* From here, codes will be used after project 3.
  * If you want to implement the function for only project 2, implement it on the
  * upper block. */
@@ -687,6 +856,82 @@ lazy_load_segment (struct page *page, void *aux) {
 	/* TODO: Load the segment from the file */
 	/* TODO: This called when the first page fault occurs on address VA. */
 	/* TODO: VA is available when calling this function. */
+	struct segment_aux *seg = aux;
+	uint8_t *kva = page->frame->kva;
+	bool success = true;
+
+	if (seg->ahead != NULL)
+		memcpy (kva, seg->ahead, seg->read_bytes);
+	else
+		success = file_read_at (seg->file, kva, seg->read_bytes, seg->ofs)
+			== (off_t) seg->read_bytes;
+	memset (kva + seg->read_bytes, 0, PGSIZE - seg->read_bytes);
+	free (seg);
+	return success;
+}
+
+/* PAGE가 lazy_load_segment()로 읽을 page이면 그 정보를, 아니면 NULL을
+   돌려준다. */
+static struct segment_aux *
+page_segment (struct page *page) {
+	if (VM_TYPE (page->operations->type) != VM_UNINIT
+			|| page->uninit.init != lazy_load_segment)
+		return NULL;
+	return page->uninit.aux;
+}
+
+/* Reads ahead the contents of those of the CNT pages in PAGES
+   that lazy_load_segment() would load.  Page I's contents go to
+   BUF + I * PGSIZE, and each run of pages that follow each other
+   in the same file is read with a single file_read_at().  Until
+   segment_read_ahead_end() is called, those pages copy their
+   contents from BUF when they are loaded.  Returns the number of
+   pages read ahead. */
+size_t
+segment_read_ahead (struct page **pages, size_t cnt, uint8_t *buf) {
+	size_t done = 0;
+	size_t i = 0;
+
+	while (i < cnt) {
+		struct segment_aux *first = page_segment (pages[i]);
+		size_t bytes, j;
+
+		if (first == NULL) {
+			i++;
+			continue;
+		}
+
+		/* 앞 page를 가득 읽고 파일에서 바로 이어지는 동안 늘린다. */
+		bytes = first->read_bytes;
+		for (j = i + 1; j < cnt && bytes == (j - i) * PGSIZE; j++) {
+			struct segment_aux *seg = page_segment (pages[j]);
+			if (seg == NULL || seg->file != first->file
+					|| seg->ofs != first->ofs + (off_t) bytes)
+				break;
+			bytes += seg->read_bytes;
+		}
+
+		if (file_read_at (first->file, buf + i * PGSIZE, bytes, first->ofs)
+				== (off_t) bytes) {
+			for (size_t k = i; k < j; k++)
+				page_segment (pages[k])->ahead = buf + k * PGSIZE;
+			done += j - i;
+		}
+		i = j;
+	}
+	return done;
+}
+
+/* Makes the pages in PAGES that segment_read_ahead() read ahead
+   but that were not loaded since read the file again, so that
+   its buffer can be freed. */
+void
+segment_read_ahead_end (struct page **pages, size_t cnt) {
+	for (size_t i = 0; i < cnt; i++) {
+		struct segment_aux *seg = page_segment (pages[i]);
+		if (seg != NULL)
+			seg->ahead = NULL;
+	}
 }
 
 /* Loads a segment starting at offset OFS in FILE at address
@@ -717,16 +962,36 @@ load_segment (struct file *file, off_t ofs, uint8_t *upage,
 		size_t page_read_bytes = read_bytes < PGSIZE ? read_bytes : PGSIZE;
 		size_t page_zero_bytes = PGSIZE - page_read_bytes;
 
+		/* 읽을 것이 없는 page(BSS)는 그냥 anon page로 만든다.  처음 읽을
+		   때는 zero page가 매핑된다. */
+		if (page_read_bytes == 0) {
+			if (!vm_alloc_page (VM_ANON, upage, writable))
+				return false;
+			read_bytes -= page_read_bytes;
+			zero_bytes -= page_zero_bytes;
+			upage += PGSIZE;
+			continue;
+		}
+
 		/* TODO: Set up aux to pass information to the lazy_load_segment. */
-		void *aux = NULL;
+		struct segment_aux *aux = malloc (sizeof *aux);
+		if (aux == NULL)
+			return false;
+		aux->file = file;
+		aux->ofs = ofs;
+		aux->read_bytes = page_read_bytes;
+		aux->ahead = NULL;
 		if (!vm_alloc_page_with_initializer (VM_ANON, upage,
-					writable, lazy_load_segment, aux))
+					writable, lazy_load_segment, aux)) {
+			free (aux);
 			return false;
+		}
 
 		/* Advance. */
 		read_bytes -= page_read_bytes;
 		zero_bytes -= page_zero_bytes;
 		upage += PGSIZE;
+		ofs += page_read_bytes;
 	}
 	return true;
 }
@@ -741,6 +1006,11 @@ setup_stack (struct intr_frame *if_) {
 	 * TODO: If success, set the rsp accordingly.
 	 * TODO: You should mark the page is stack. */
 	/* TODO: Your code goes here */
+	if (vm_alloc_page (VM_ANON | VM_MARKER_0, stack_bottom, true)
+			&& vm_claim_page (stack_bottom)) {
+		success = true;
+		if_->rsp = USER_STACK;
+	}
 
 	return success;
 }
@@ -16,6 +16,9 @@
 #include "lib/kernel/stdio.h"
 #include "threads/palloc.h"
 
+/* 파일 시스템 접근용 lock.  read는 동시에, write는 혼자 수행한다. */
+struct rwlock filesys_lock;
+
 void syscall_entry (void);
 void syscall_handler (struct intr_frame *);
 void check_address(void *addr);
@@ -58,7 +61,7 @@ syscall_init (void) {
 	 * mode stack. Therefore, we masked the FLAG_FL. */
 	write_msr(MSR_SYSCALL_MASK,
 			FLAG_IF | FLAG_TF | FLAG_DF | FLAG_IOPL | FLAG_AC | FLAG_NT);
-	lock_init(&filesys_lock);
+	rwlock_init(&filesys_lock);
 }
 
 /* The main system call interface */
@@ -119,8 +122,14 @@ void check_address(void *addr){
 		exit(-1);
 	if (!is_user_vaddr(addr))
 		exit(-1);
+#ifdef VM
+	/* 아직 frame이 없는 page는 접근할 때 fault로 올라온다. */
+	if (spt_find_page(&thread_current()->spt, addr) == NULL)
+		exit(-1);
+#else
 	if (pml4_get_page(thread_current()->pml4, addr) == NULL)
 		exit(-1);
+#endif
 	// if (addr == NULL || !(is_user_vaddr(addr))||pml4_get_page(cur->pml4, addr) == NULL){
 	// 	exit(-1);
 	// }
@@ -202,7 +211,7 @@ int read(int fd, void *buffer, unsigned size)
 	char *ptr = (char *)buffer;
 	int bytes_read = 0;
 
-	lock_acquire(&filesys_lock); // 락을 요구합니다.
+	rwlock_acquire_read(&filesys_lock); // 락을 요구합니다.
 	if(fd == STDIN_FILENO)
 	{
 		for (int i = 0; i < size; i++)
@@ -210,23 +219,23 @@ int read(int fd, void *buffer, unsigned size)
 			*ptr++ = input_getc();
 			bytes_read++;
 		}
-		lock_release(&filesys_lock);
+		rwlock_release_read(&filesys_lock);
 	}
 	else
 	{
 		if (fd < 2)
 		{
-			lock_release(&filesys_lock);
+			rwlock_release_read(&filesys_lock);
 			return -1;
 		}
 		struct file *file = process_get_file(fd);
 		if (file == NULL)
 		{
-			lock_release(&filesys_lock);
+			rwlock_release_read(&filesys_lock);
 			return -1;
 		}
 		bytes_read = file_read(file, buffer, size);
-		lock_release(&filesys_lock);
+		rwlock_release_read(&filesys_lock);
 	}
 	return bytes_read;
 }
@@ -248,9 +257,9 @@ int write(int fd, const void *buffer, unsigned size)
 		struct file *file = process_get_file(fd);
 		if (file == NULL)
 			return -1;
-		lock_acquire(&filesys_lock);
+		rwlock_acquire_write(&filesys_lock);
 		bytes_write = file_write(file, buffer, size);
-		lock_release(&filesys_lock);
+		rwlock_release_write(&filesys_lock);
 	}
 	return bytes_write;
 }
@@ -1,7 +1,10 @@
 /* anon.c: Implementation of page for non-disk image (a.k.a. anonymous page). */
 
 #include "vm/vm.h"
+#include <string.h>
 #include "devices/disk.h"
+#include "threads/vaddr.h"
+#include "vm/swap.h"
 
 /* DO NOT MODIFY BELOW LINE */
 static struct disk *swap_disk;
@@ -21,7 +24,8 @@ static const struct page_operations anon_ops = {
 void
 vm_anon_init (void) {
 	/* TODO: Set up the swap_disk. */
-	swap_disk = NULL;
+	swap_disk = disk_get (1, 1);
+	swap_init (swap_disk);
 }
 
 /* Initialize the file mapping */
@@ -31,22 +35,49 @@ anon_initializer (struct page *page, enum vm_type type, void *kva) {
 	page->operations = &anon_ops;
 
 	struct anon_page *anon_page = &page->anon;
+	anon_page->slot = SWAP_SLOT_NONE;
+	return true;
+}
+
+/* PAGE가 anon page이고 frame도 swap slot도 없으면, 즉 내용이 모두
+   0이면 true. */
+bool
+anon_is_zero (struct page *page) {
+	return page->operations == &anon_ops && page->frame == NULL
+		&& page->anon.slot == SWAP_SLOT_NONE;
 }
 
 /* Swap in the page by read contents from the swap disk. */
 static bool
 anon_swap_in (struct page *page, void *kva) {
 	struct anon_page *anon_page = &page->anon;
+
+	if (anon_page->slot == SWAP_SLOT_NONE) {
+		memset (kva, 0, PGSIZE);
+		return true;
+	}
+	swap_read (anon_page->slot, kva);
+	swap_free (anon_page->slot);
+	anon_page->slot = SWAP_SLOT_NONE;
+	return true;
 }
 
 /* Swap out the page by writing contents to the swap disk. */
 static bool
 anon_swap_out (struct page *page) {
 	struct anon_page *anon_page = &page->anon;
+
+	/* 실제로 쓰는 것은 swapd가 나중에 한다.  frame은 그때까지
+	   swap이 갖고 있다.  내용이 모두 0이면 slot 없이 돌아온다. */
+	anon_page->slot = swap_queue (page->frame);
+	return true;
 }
 
 /* Destroy the anonymous page. PAGE will be freed by the caller. */
 static void
 anon_destroy (struct page *page) {
 	struct anon_page *anon_page = &page->anon;
+
+	if (anon_page->slot != SWAP_SLOT_NONE)
+		swap_free (anon_page->slot);
 }
@@ -0,0 +1,382 @@
+/* evict.c: Page replacement policies for the frame table. */
+
+#include "vm/evict.h"
+#include <debug.h>
+#include <hash.h>
+#include <list.h>
+#include "threads/slab.h"
+
+/* Page replacement policies.
+
+   The frame table in vm.c hands every resident frame to the
+   active policy with add() and takes it back with remove() when
+   the page is freed.  When the user pool runs dry it calls
+   victim(), which must pick an unpinned frame, take it off its
+   own lists, and return it.  All calls are made with frame_lock
+   held, so the policies need no locking of their own.
+
+   None of the policies see individual accesses.  They learn about
+   them only from the accessed bits in the page tables, which they
+   test and clear as they scan with vm_frame_accessed().
+
+   CLOCK keeps all frames on one circular list and sweeps a hand
+   over it, giving each frame whose accessed bit is set a second
+   chance.
+
+   2Q keeps an inactive and an active list.  New frames start out
+   inactive.  The victim is taken from the front of the inactive
+   list, but a frame found to have been accessed there, or pinned,
+   is promoted to the active list instead.  Whenever the active
+   list grows larger than the inactive list, frames from its front
+   are moved back to the inactive list, so a page referenced once
+   does not stay resident for long, while a page in steady use
+   does.
+
+   ARC is adapted to reference bits in the manner of CAR ("CLOCK
+   with Adaptive Replacement").  T1 holds frames seen once
+   recently, T2 frames seen at least twice, each swept like a
+   clock.  B1 and B2 remember the pages most recently evicted from
+   T1 and T2 ("ghosts").  A fault on a page in B1 means T1 was too
+   small, so the target size P of T1 grows; a fault on a page in
+   B2 shrinks it.  The victim comes from T1 if T1 holds at least P
+   frames, otherwise from T2.
+
+   Ghosts are keyed by the pml4 and address the page was mapped
+   at.  A pml4 page freed at exit may come straight back from the
+   page-table cache for a new process, so forget() drops a dying
+   pml4's ghosts before they can turn into false hits. */
+
+/* Moves F to the back of LIST, which is list number ID. */
+static void
+move_to (struct frame *f, struct list *list, int id) {
+	list_push_back (list, &f->elem);
+	f->list = id;
+}
+
+/* Takes the frame off the front of LIST. */
+static struct frame *
+pop (struct list *list) {
+	return list_entry (list_pop_front (list), struct frame, elem);
+}
+
+/* ---- CLOCK ---- */
+
+static struct list clock_list;      /* All frames, in hand order. */
+static struct list_elem *clock_hand;/* Next frame to look at. */
+static size_t clock_cnt;            /* Frames in clock_list. */
+
+static void
+clock_init (void) {
+	list_init (&clock_list);
+	clock_hand = list_end (&clock_list);
+	clock_cnt = 0;
+}
+
+static void
+clock_add (struct frame *f) {
+	/* hand 바로 앞에 넣어 한 바퀴 뒤에 보게 한다. */
+	list_insert (clock_hand, &f->elem);
+	clock_cnt++;
+}
+
+static void
+clock_remove (struct frame *f) {
+	if (clock_hand == &f->elem)
+		clock_hand = list_next (clock_hand);
+	list_remove (&f->elem);
+	clock_cnt--;
+}
+
+static struct frame *
+clock_victim (void) {
+	/* 두 바퀴 돌면 accessed bit이 모두 지워진다. */
+	for (size_t i = 0; i < 2 * clock_cnt + 1; i++) {
+		struct frame *f;
+
+		if (clock_hand == list_end (&clock_list))
+			clock_hand = list_begin (&clock_list);
+		if (clock_hand == list_end (&clock_list))
+			break;
+		f = list_entry (clock_hand, struct frame, elem);
+		clock_hand = list_next (clock_hand);
+		if (!f->pinned && !vm_frame_accessed (f)) {
+			clock_remove (f);
+			return f;
+		}
+	}
+	return NULL;
+}
+
+const struct evict_policy evict_clock = {
+	.name = "clock",
+	.init = clock_init,
+	.add = clock_add,
+	.remove = clock_remove,
+	.victim = clock_victim,
+};
+
+/* ---- 2Q ---- */
+
+enum { Q_INACTIVE, Q_ACTIVE };
+
+static struct list q_lists[2];      /* Indexed by Q_*. */
+static size_t q_cnt[2];
+
+static void
+q_init (void) {
+	for (int i = 0; i < 2; i++) {
+		list_init (&q_lists[i]);
+		q_cnt[i] = 0;
+	}
+}
+
+/* Appends F to list ID. */
+static void
+q_push (struct frame *f, int id) {
+	move_to (f, &q_lists[id], id);
+	q_cnt[id]++;
+}
+
+static void
+q_add (struct frame *f) {
+	q_push (f, Q_INACTIVE);
+}
+
+static void
+q_remove (struct frame *f) {
+	list_remove (&f->elem);
+	q_cnt[f->list]--;
+}
+
+/* active list가 inactive보다 커지지 않게 앞쪽부터 내려보낸다. */
+static void
+q_balance (void) {
+	while (q_cnt[Q_ACTIVE] > q_cnt[Q_INACTIVE]) {
+		struct frame *f = pop (&q_lists[Q_ACTIVE]);
+
+		q_cnt[Q_ACTIVE]--;
+		vm_frame_accessed (f);
+		q_push (f, Q_INACTIVE);
+	}
+}
+
+static struct frame *
+q_victim (void) {
+	size_t tries = 3 * (q_cnt[Q_INACTIVE] + q_cnt[Q_ACTIVE]) + 1;
+
+	while (tries-- > 0) {
+		struct frame *f;
+
+		q_balance ();
+		if (q_cnt[Q_INACTIVE] == 0)
+			break;
+		f = pop (&q_lists[Q_INACTIVE]);
+		q_cnt[Q_INACTIVE]--;
+		if (f->pinned || vm_frame_accessed (f))
+			q_push (f, Q_ACTIVE);
+		else
+			return f;
+	}
+	return NULL;
+}
+
+const struct evict_policy evict_2q = {
+	.name = "2q",
+	.init = q_init,
+	.add = q_add,
+	.remove = q_remove,
+	.victim = q_victim,
+};
+
+/* ---- ARC ---- */
+
+enum { ARC_T1, ARC_T2, ARC_B1, ARC_B2 };
+
+/* A recently evicted page, remembered by where it was mapped. */
+struct ghost {
+	uint64_t *pml4;
+	void *va;
+	int list;                       /* ARC_B1 or ARC_B2. */
+	struct list_elem elem;          /* Element in arc_lists[list]. */
+	struct hash_elem hash_elem;     /* Element in ghosts. */
+};
+
+static struct list arc_lists[4];    /* Indexed by ARC_*. */
+static size_t arc_cnt[4];
+static size_t arc_p;                /* Target size of T1. */
+static struct hash ghosts;          /* All ghosts, by (pml4, va). */
+static struct kmem_cache *ghost_cache;
+
+static uint64_t
+ghost_hash (const struct hash_elem *e, void *aux UNUSED) {
+	const struct ghost *g = hash_entry (e, struct ghost, hash_elem);
+	return hash_bytes (&g->pml4, sizeof g->pml4) ^ hash_bytes (&g->va,
+	                                                           sizeof g->va);
+}
+
+static bool
+ghost_less (const struct hash_elem *a_, const struct hash_elem *b_,
+            void *aux UNUSED) {
+	const struct ghost *a = hash_entry (a_, struct ghost, hash_elem);
+	const struct ghost *b = hash_entry (b_, struct ghost, hash_elem);
+
+	if (a->pml4 != b->pml4)
+		return a->pml4 < b->pml4;
+	return a->va < b->va;
+}
+
+static void
+arc_init (void) {
+	for (int i = 0; i < 4; i++) {
+		list_init (&arc_lists[i]);
+		arc_cnt[i] = 0;
+	}
+	arc_p = 0;
+	if (!hash_init (&ghosts, ghost_hash, ghost_less, NULL))
+		PANIC ("arc_init: out of memory");
+	ghost_cache = kmem_cache_create ("ghost", sizeof (struct ghost), NULL);
+}
+
+/* Returns the number of resident frames. */
+static size_t
+arc_resident (void) {
+	return arc_cnt[ARC_T1] + arc_cnt[ARC_T2];
+}
+
+static void
+arc_push (struct frame *f, int id) {
+	move_to (f, &arc_lists[id], id);
+	arc_cnt[id]++;
+}
+
+static void
+ghost_drop (struct ghost *g) {
+	list_remove (&g->elem);
+	arc_cnt[g->list]--;
+	hash_delete (&ghosts, &g->hash_elem);
+	kmem_cache_free (ghost_cache, g);
+}
+
+/* Remembers the page in F, which is being evicted, in list ID.
+   B1과 B2를 합쳐 resident frame 수를 넘지 않게 오래된 것부터 잊는다. */
+static void
+ghost_add (struct frame *f, int id) {
+	size_t c = arc_resident () + 1;
+	struct ghost *g;
+
+	while (arc_cnt[ARC_B1] + arc_cnt[ARC_B2] >= c) {
+		bool b1 = arc_cnt[ARC_B1] > 0
+		          && (arc_cnt[ARC_T1] + arc_cnt[ARC_B1] >= c
+		              || arc_cnt[ARC_B2] == 0);
+		struct list *l = &arc_lists[b1 ? ARC_B1 : ARC_B2];
+		ghost_drop (list_entry (list_front (l), struct ghost, elem));
+	}
+
+	g = kmem_cache_alloc (ghost_cache);
+	if (g == NULL)
+		return;
+	g->pml4 = f->page->pml4;
+	g->va = f->page->va;
+	g->list = id;
+	if (hash_insert (&ghosts, &g->hash_elem) != NULL) {
+		kmem_cache_free (ghost_cache, g);
+		return;
+	}
+	list_push_back (&arc_lists[id], &g->elem);
+	arc_cnt[id]++;
+}
+
+static void
+arc_add (struct frame *f) {
+	struct ghost key, *g = NULL;
+	struct hash_elem *e;
+
+	key.pml4 = f->page->pml4;
+	key.va = f->page->va;
+	e = hash_find (&ghosts, &key.hash_elem);
+	if (e == NULL) {
+		arc_push (f, ARC_T1);
+		return;
+	}
+
+	/* 최근에 내보낸 page가 다시 들어왔다.  어느 쪽에서 나갔는지에
+	   따라 T1의 목표 크기를 조정한다. */
+	g = hash_entry (e, struct ghost, hash_elem);
+	if (g->list == ARC_B1) {
+		size_t delta = arc_cnt[ARC_B2] / arc_cnt[ARC_B1];
+		size_t c = arc_resident () + 1;
+
+		arc_p += delta > 1 ? delta : 1;
+		if (arc_p > c)
+			arc_p = c;
+	} else {
+		size_t delta = arc_cnt[ARC_B1] / arc_cnt[ARC_B2];
+
+		delta = delta > 1 ? delta : 1;
+		arc_p = arc_p > delta ? arc_p - delta : 0;
+	}
+	ghost_drop (g);
+	arc_push (f, ARC_T2);
+}
+
+static void
+arc_remove (struct frame *f) {
+	list_remove (&f->elem);
+	arc_cnt[f->list]--;
+}
+
+static void
+arc_forget (uint64_t *pml4) {
+	for (int id = ARC_B1; id <= ARC_B2; id++) {
+		struct list_elem *e = list_begin (&arc_lists[id]);
+
+		while (e != list_end (&arc_lists[id])) {
+			struct ghost *g = list_entry (e, struct ghost, elem);
+
+			e = list_next (e);
+			if (g->pml4 == pml4)
+				ghost_drop (g);
+		}
+	}
+}
+
+static struct frame *
+arc_victim (void) {
+	size_t tries = 3 * arc_resident () + 1;
+	size_t t2_pinned = 0;
+
+	while (tries-- > 0) {
+		/* T2가 모두 고정되어 있으면 P와 상관없이 T1에서 고른다. */
+		bool from_t1 = arc_cnt[ARC_T1] > 0
+		               && (arc_cnt[ARC_T1] >= arc_p
+		                   || arc_cnt[ARC_T2] <= t2_pinned);
+		int id = from_t1 ? ARC_T1 : ARC_T2;
+		struct frame *f;
+
+		if (arc_cnt[id] == 0)
+			break;
+		f = pop (&arc_lists[id]);
+		arc_cnt[id]--;
+		if (f->pinned) {
+			/* 커널이 쓰고 있는 frame은 사용 중인 것으로 본다. */
+			if (!from_t1)
+				t2_pinned++;
+			arc_push (f, ARC_T2);
+		} else if (vm_frame_accessed (f))
+			arc_push (f, ARC_T2);
+		else {
+			ghost_add (f, from_t1 ? ARC_B1 : ARC_B2);
+			return f;
+		}
+	}
+	return NULL;
+}
+
+const struct evict_policy evict_arc = {
+	.name = "arc",
+	.init = arc_init,
+	.add = arc_add,
+	.remove = arc_remove,
+	.victim = arc_victim,
+	.forget = arc_forget,
+};
@@ -0,0 +1,292 @@
+/* swap.c: Swap slot allocator and asynchronous swap writer. */
+
+#include "vm/swap.h"
+#include <bitmap.h>
+#include <debug.h>
+#include <list.h>
+#include <stdio.h>
+#include <string.h>
+#include "devices/disk.h"
+#include "threads/malloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+#include "vm/vm.h"
+
+/* Swap.
+
+   The swap disk is divided into page-sized slots of
+   SECTORS_PER_SLOT sectors each, tracked by a bitmap.
+
+   Pages are swapped out in batches.  The frame table reserves a
+   run of up to SWAP_CLUSTER contiguous slots with
+   swap_batch_begin(), hands over the frames of the pages it
+   evicts one at a time with swap_queue(), and then calls
+   swap_batch_submit().  The "swapd" thread writes each submitted
+   batch to its run of sectors, in submission order, and gives
+   the frames back to the frame table with vm_frame_written().
+   The evicting thread never waits for the disk.
+
+   A page that is all zeros is not written at all.  swap_queue()
+   returns SWAP_SLOT_NONE for it, and the page reads back as zeros
+   (see the zero page in vm.c).
+
+   Until its batch is written, a page's contents are still in its
+   old frame.  swap_read() copies them from there instead of
+   waiting for the write.
+
+   After a copy-on-write fork, one frame may hold the page of
+   several processes.  Evicting it queues the frame once per page,
+   but all of them share one slot, which keeps a reference count.
+
+   A slot may be freed while a batch that writes it is still
+   pending.  That is harmless: swapd writes batches one at a time
+   in order, so a later batch that reuses the slot overwrites it
+   afterward, and swap_read() looks for the newest batch first. */
+
+#define SECTORS_PER_SLOT (PGSIZE / DISK_SECTOR_SIZE)
+
+/* A run of slots written out together. */
+struct swap_batch {
+	swap_slot_t start;                  /* First slot. */
+	size_t cnt;                         /* Number of slots. */
+	size_t used;                        /* Slots handed out so far. */
+	struct frame *frames[SWAP_CLUSTER]; /* Contents of each slot. */
+	struct list_elem elem;              /* Element in pending. */
+};
+
+static struct disk *swap_disk;
+static struct bitmap *slots;        /* Slots in use. */
+static uint16_t *slot_refs;         /* Pages referring to each slot. */
+static size_t slots_used;
+
+/* 채우는 중인 batch.  frame_lock을 쥔 frame table만 다룬다. */
+static struct swap_batch *open_batch;
+
+/* swap_lock protects SLOTS, SLOT_REFS, SLOTS_USED, PENDING, and
+   the statistics. */
+static struct lock swap_lock;
+static struct list pending;         /* Submitted batches, newest first. */
+static struct semaphore submitted;  /* Up'd once per batch. */
+
+/* Statistics. */
+static unsigned long long batch_cnt;    /* Batches written. */
+static unsigned long long out_cnt;      /* Pages written. */
+static unsigned long long in_cnt;       /* Pages read back in. */
+static unsigned long long rescue_cnt;   /* ...of those, from memory. */
+static unsigned long long zero_cnt;     /* Zero pages not written. */
+
+static void swapd (void *aux);
+
+/* Initializes swap on DISK, which may be null if there is no
+   swap disk, and starts the swap writer. */
+void
+swap_init (struct disk *disk) {
+	size_t slot_cnt = disk != NULL ? disk_size (disk) / SECTORS_PER_SLOT : 0;
+
+	swap_disk = disk;
+	slots = bitmap_create (slot_cnt);
+	slot_refs = calloc (slot_cnt, sizeof *slot_refs);
+	if (slots == NULL || (slot_cnt > 0 && slot_refs == NULL))
+		PANIC ("swap_init: out of memory");
+	slots_used = 0;
+	open_batch = NULL;
+	lock_init (&swap_lock);
+	list_init (&pending);
+	sema_init (&submitted, 0);
+	thread_create ("swapd", PRI_DEFAULT, swapd, NULL);
+}
+
+/* Starts a new batch of up to CNT pages (at most SWAP_CLUSTER)
+   and returns how many slots it got, which may be fewer than CNT
+   if swap is fragmented, or 0 if swap is full. */
+size_t
+swap_batch_begin (size_t cnt) {
+	struct swap_batch *b;
+	size_t start = BITMAP_ERROR;
+
+	ASSERT (open_batch == NULL);
+	ASSERT (cnt > 0 && cnt <= SWAP_CLUSTER);
+
+	b = malloc (sizeof *b);
+	if (b == NULL)
+		return 0;
+
+	/* 연속된 slot을 못 찾으면 절반씩 줄여 본다. */
+	lock_acquire (&swap_lock);
+	for (; cnt > 0; cnt /= 2) {
+		start = bitmap_scan_hint (slots, cnt, false);
+		if (start != BITMAP_ERROR)
+			break;
+	}
+	if (start != BITMAP_ERROR) {
+		bitmap_set_multiple (slots, start, cnt, true);
+		slots_used += cnt;
+	}
+	lock_release (&swap_lock);
+
+	if (start == BITMAP_ERROR) {
+		free (b);
+		return 0;
+	}
+	b->start = start;
+	b->cnt = cnt;
+	b->used = 0;
+	open_batch = b;
+	return cnt;
+}
+
+/* Returns true if the page at KVA is all zeros. */
+static bool
+page_is_zero (const void *kva) {
+	const uint64_t *p = kva;
+
+	for (size_t i = 0; i < PGSIZE / sizeof *p; i++)
+		if (p[i] != 0)
+			return false;
+	return true;
+}
+
+/* Adds FRAME to the open batch and returns the slot its contents
+   will be written to.  FRAME must no longer be mapped.  It
+   belongs to swap until it is handed back by
+   vm_frame_written().  Queuing the same frame again, for another
+   page that shares it, returns the same slot with one more
+   reference.  If FRAME is all zeros, returns SWAP_SLOT_NONE and
+   leaves FRAME to the caller. */
+swap_slot_t
+swap_queue (struct frame *frame) {
+	struct swap_batch *b = open_batch;
+	swap_slot_t slot;
+
+	ASSERT (b != NULL);
+
+	for (size_t i = 0; i < b->used; i++)
+		if (b->frames[i] == frame) {
+			slot = b->start + i;
+			lock_acquire (&swap_lock);
+			ASSERT (slot_refs[slot] < UINT16_MAX);
+			slot_refs[slot]++;
+			lock_release (&swap_lock);
+			return slot;
+		}
+
+	if (page_is_zero (frame->kva)) {
+		lock_acquire (&swap_lock);
+		zero_cnt++;
+		lock_release (&swap_lock);
+		return SWAP_SLOT_NONE;
+	}
+
+	ASSERT (b->used < b->cnt);
+	frame->writeback = true;
+	b->frames[b->used] = frame;
+	slot = b->start + b->used++;
+	lock_acquire (&swap_lock);
+	slot_refs[slot] = 1;
+	lock_release (&swap_lock);
+	return slot;
+}
+
+/* Hands the open batch to swapd.  Slots that were reserved but
+   not used are freed. */
+void
+swap_batch_submit (void) {
+	struct swap_batch *b = open_batch;
+
+	ASSERT (b != NULL);
+	open_batch = NULL;
+
+	lock_acquire (&swap_lock);
+	bitmap_set_multiple (slots, b->start + b->used, b->cnt - b->used, false);
+	slots_used -= b->cnt - b->used;
+	b->cnt = b->used;
+	if (b->cnt > 0)
+		list_push_front (&pending, &b->elem);
+	lock_release (&swap_lock);
+
+	if (b->cnt > 0)
+		sema_up (&submitted);
+	else
+		free (b);
+}
+
+/* Reads the page in SLOT into KVA. */
+void
+swap_read (swap_slot_t slot, void *kva) {
+	struct list_elem *e;
+
+	lock_acquire (&swap_lock);
+	in_cnt++;
+	for (e = list_begin (&pending); e != list_end (&pending);
+	     e = list_next (e)) {
+		struct swap_batch *b = list_entry (e, struct swap_batch, elem);
+
+		if (slot >= b->start && slot < b->start + b->cnt) {
+			/* 아직 디스크에 쓰는 중이다.  frame에 남은 내용을 쓴다. */
+			memcpy (kva, b->frames[slot - b->start]->kva, PGSIZE);
+			rescue_cnt++;
+			lock_release (&swap_lock);
+			return;
+		}
+	}
+	lock_release (&swap_lock);
+
+	for (size_t i = 0; i < SECTORS_PER_SLOT; i++)
+		disk_read (swap_disk, slot * SECTORS_PER_SLOT + i,
+		           (uint8_t *) kva + i * DISK_SECTOR_SIZE);
+}
+
+/* Drops a reference to SLOT, freeing it when none are left. */
+void
+swap_free (swap_slot_t slot) {
+	lock_acquire (&swap_lock);
+	ASSERT (bitmap_test (slots, slot));
+	ASSERT (slot_refs[slot] > 0);
+	if (--slot_refs[slot] == 0) {
+		bitmap_reset (slots, slot);
+		slots_used--;
+	}
+	lock_release (&swap_lock);
+}
+
+/* Prints swap statistics. */
+void
+swap_print_stats (void) {
+	printf ("Swap: %zu of %zu slots in use, %llu pages out in %llu batches, "
+	        "%llu zero pages skipped, %llu in (%llu from memory)\n",
+	        slots_used, bitmap_size (slots), out_cnt, batch_cnt,
+	        zero_cnt, in_cnt, rescue_cnt);
+}
+
+/* Swap writer thread.  Writes submitted batches, oldest first. */
+static void
+swapd (void *aux UNUSED) {
+	for (;;) {
+		struct swap_batch *b;
+
+		sema_down (&submitted);
+		lock_acquire (&swap_lock);
+		b = list_entry (list_back (&pending), struct swap_batch, elem);
+		lock_release (&swap_lock);
+
+		/* 한 batch의 sector는 디스크에서 연달아 있다. */
+		for (size_t i = 0; i < b->cnt; i++) {
+			const uint8_t *kva = b->frames[i]->kva;
+			disk_sector_t sector = (b->start + i) * SECTORS_PER_SLOT;
+
+			for (size_t j = 0; j < SECTORS_PER_SLOT; j++)
+				disk_write (swap_disk, sector + j, kva + j * DISK_SECTOR_SIZE);
+		}
+
+		lock_acquire (&swap_lock);
+		list_remove (&b->elem);
+		batch_cnt++;
+		out_cnt += b->cnt;
+		lock_release (&swap_lock);
+
+		for (size_t i = 0; i < b->cnt; i++)
+			vm_frame_written (b->frames[i]);
+		free (b);
+	}
+}
@@ -1,9 +1,86 @@
 /* vm.c: Generic interface for virtual memory objects. */
 
+#include <stdio.h>
+#include <string.h>
 #include "threads/malloc.h"
+#include "threads/mmu.h"
+#include "threads/slab.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
+#include "threads/vmalloc.h"
+#include "userprog/compact.h"
+#include "userprog/process.h"
 #include "vm/vm.h"
+#include "vm/evict.h"
+#include "vm/swap.h"
 #include "vm/inspect.h"
 
+/* struct page 전용 object cache.  free()가 kmem 객체를 알아보므로
+   vm_dealloc_page()는 그대로 둔다. */
+static struct kmem_cache *page_cache;
+
+/* Frame table.
+   page가 올라와 있는 frame은 모두 eviction policy의 list에 있다.
+   frame_lock은 policy의 list와 page<->frame 연결을 보호한다.  frame에
+   내용을 채우는 동안(swap이나 파일 읽기)에는 놓아 두어, 다른 fault와
+   swapd의 vm_frame_written()이 디스크를 기다리지 않게 한다.
+
+   user pool이 바닥나면 SWAP_CLUSTER개씩 묶어 내보낸다.  내보낸
+   frame은 swapd가 다 쓴 뒤 free_frames로 돌아오고, 그동안 fault를
+   낸 스레드는 free_frames에 남은 frame을 쓴다.  free_frames와 쓰는
+   중인 frame의 합이 FRAME_RESERVE보다 적어지면 다음 묶음을 미리
+   내보내 두어, 보통은 디스크 쓰기를 기다리지 않는다. */
+#define FRAME_RESERVE SWAP_CLUSTER
+static struct kmem_cache *frame_cache;
+static kmem_ctor_func frame_ctor;
+static struct lock frame_lock;
+static struct list free_frames;         /* 내보낸 뒤 비어 있는 frame. */
+static struct condition frame_freed;    /* free_frames에 frame이 생겼다. */
+static size_t free_cnt;                 /* Frames in free_frames. */
+static size_t writeback_cnt;            /* Frames being written to swap. */
+
+/* Zero page.
+   아직 한 번도 쓰지 않은 anon page에서 읽기 fault가 나면 frame을
+   주지 않고 이 page를 읽기 전용으로 매핑한다.  처음 쓸 때
+   vm_handle_wp()에서 자기 frame을 받는다.  어느 policy에도 들어가지
+   않으며 해제하지 않는다. */
+static void *zero_page;
+
+/* Huge pages.
+   2MB 정렬된 구역의 page 512개가 모두 아직 올라온 적 없는 anon
+   page(BSS나 ELF segment)이고 쓰기 권한이 같으면, 그중 한 곳의
+   fault에서 palloc_get_huge_page()로 2MB를 받아 huge page 하나로
+   매핑한다.  frame은 그대로 4 kB마다 하나씩 두므로 policy와 swap은
+   다른 frame과 똑같이 다룬다.  그중 한 page만 내보내거나 copy-on-write로
+   바꿀 때는 먼저 pml4_split_huge_page()로 나눈다.  나누기 전에는 512
+   frame이 PDE의 accessed bit 하나를 함께 쓴다. */
+
+/* 사용할 수 있는 policy.  맨 앞이 기본값. */
+static const struct evict_policy *const policies[] = {
+	&evict_clock, &evict_2q, &evict_arc,
+};
+static const struct evict_policy *policy = &evict_clock;
+
+/* Statistics. */
+static size_t frame_cnt;                /* Frames taken from the pool. */
+static unsigned long long evict_cnt;    /* Frames evicted. */
+static unsigned long long wait_cnt;     /* Times a fault waited for swap. */
+static unsigned long long share_cnt;    /* Pages shared by fork. */
+static unsigned long long cow_cnt;      /* Pages copied on write. */
+static unsigned long long zero_cnt;     /* Reads served by zero_page. */
+static unsigned long long around_cnt;   /* Faults that mapped neighbors. */
+static unsigned long long around_pages; /* Neighbors mapped. */
+static unsigned long long ahead_pages;  /* Pages read ahead. */
+static unsigned long long huge_cnt;     /* Huge pages mapped. */
+
+/* Fault-around window, in pages.  Always a power of 2. */
+#define FAULT_AROUND 16                 /* Initial window. */
+#define FAULT_AROUND_MAX 64             /* Largest window. */
+
+/* 마지막으로 user pool에서 frame을 못 받았는지.  그동안은 미리
+   올리지 않는다. */
+static bool pool_dry;
+
 /* Initializes the virtual memory subsystem by invoking each subsystem's
  * intialize codes. */
 void
@@ -16,6 +93,58 @@ vm_init (void) {
 	register_inspect_intr ();
 	/* DO NOT MODIFY UPPER LINES. */
 	/* TODO: Your code goes here. */
+	page_cache = kmem_cache_create ("page", sizeof (struct page), NULL);
+	zero_page = palloc_get_page (PAL_ZERO);
+	if (zero_page == NULL)
+		PANIC ("vm_init: cannot allocate zero page");
+	frame_cache = kmem_cache_create ("frame", sizeof (struct frame),
+	                                 frame_ctor);
+	lock_init (&frame_lock);
+	list_init (&free_frames);
+	cond_init (&frame_freed);
+	policy->init ();
+}
+
+/* Selects the eviction policy named NAME ("-evict=NAME").
+   Returns false if there is no such policy.  Must be called
+   before vm_init(). */
+bool
+vm_set_evict_policy (const char *name) {
+	for (size_t i = 0; i < sizeof policies / sizeof *policies; i++)
+		if (!strcmp (policies[i]->name, name)) {
+			policy = policies[i];
+			return true;
+		}
+	return false;
+}
+
+/* Prints frame table statistics. */
+void
+vm_print_stats (void) {
+	printf ("Frames: %s eviction, %zu frames, %zu free, %llu evicted, "
+	        "%llu waits\n", policy->name, frame_cnt, free_cnt, evict_cnt,
+	        wait_cnt);
+	printf ("Fork: %llu pages shared, %llu copied on write\n",
+	        share_cnt, cow_cnt);
+	printf ("Zero page: %llu read faults\n", zero_cnt);
+	printf ("Fault-around: %llu faults mapped %llu neighbors, "
+	        "%llu pages read ahead\n", around_cnt, around_pages, ahead_pages);
+	printf ("Huge pages: %llu mapped\n", huge_cnt);
+	swap_print_stats ();
+}
+
+/* Called by swap when FRAME, queued by anon_swap_out(), has been
+   written out and may be reused. */
+void
+vm_frame_written (struct frame *frame) {
+	lock_acquire (&frame_lock);
+	ASSERT (frame->writeback);
+	frame->writeback = false;
+	writeback_cnt--;
+	list_push_back (&free_frames, &frame->elem);
+	free_cnt++;
+	cond_signal (&frame_freed, &frame_lock);
+	lock_release (&frame_lock);
 }
 
 /* Get the type of the page. This function is useful if you want to know the
@@ -35,7 +164,13 @@ page_get_type (struct page *page) {
 /* Helpers */
 static struct frame *vm_get_victim (void);
 static bool vm_do_claim_page (struct page *page);
-static struct frame *vm_evict_frame (void);
+static bool claim_page_in (struct page *page, uint64_t *pml4);
+static struct frame *vm_evict_frame (struct tlb_batch *);
+static void frame_swap_out (struct frame *frame);
+static bool vm_reclaim (void);
+static void frame_link (struct frame *frame, struct page *page);
+static void frame_unlink (struct frame *frame, struct page *page);
+static void frame_free (struct frame *frame);
 
 /* Create the pending page object with initializer. If you want to create a
  * page, do not create it directly and make it through this function or
@@ -47,41 +182,103 @@ vm_alloc_page_with_initializer (enum vm_type type, void *upage, bool writable,
 	ASSERT (VM_TYPE(type) != VM_UNINIT)
 
 	struct supplemental_page_table *spt = &thread_current ()->spt;
+	bool (*initializer) (struct page *, enum vm_type, void *);
+	struct page *page;
+
+	upage = pg_round_down (upage);
 
 	/* Check wheter the upage is already occupied or not. */
 	if (spt_find_page (spt, upage) == NULL) {
 		/* TODO: Create the page, fetch the initialier according to the VM type,
 		 * TODO: and then create "uninit" page struct by calling uninit_new. You
 		 * TODO: should modify the field after calling the uninit_new. */
+		switch (VM_TYPE (type)) {
+			case VM_ANON:
+				initializer = anon_initializer;
+				break;
+			case VM_FILE:
+				initializer = file_backed_initializer;
+				break;
+			default:
+				goto err;
+		}
+		page = kmem_cache_alloc (page_cache);
+		if (page == NULL)
+			goto err;
+		uninit_new (page, upage, init, type, aux, initializer);
+		page->writable = writable;
 
 		/* TODO: Insert the page into the spt. */
+		if (!spt_insert_page (spt, page)) {
+			kmem_cache_free (page_cache, page);
+			goto err;
+		}
+		return true;
 	}
 err:
 	return false;
 }
 
-/* Find VA from spt and return page. On error, return NULL. */
+/* Find VA from spt and return page. On error, return NULL.
+ * 잠금 없이 radix tree를 네 단계 내려가므로 fault 경로에서 바로 쓴다. */
 struct page *
-spt_find_page (struct supplemental_page_table *spt UNUSED, void *va UNUSED) {
-	struct page *page = NULL;
-	/* TODO: Fill this function. */
-
-	return page;
+spt_find_page (struct supplemental_page_table *spt, void *va) {
+	return radix_lookup (&spt->pages, va);
 }
 
 /* Insert PAGE into spt with validation. */
 bool
-spt_insert_page (struct supplemental_page_table *spt UNUSED,
-		struct page *page UNUSED) {
-	int succ = false;
-	/* TODO: Fill this function. */
+spt_insert_page (struct supplemental_page_table *spt, struct page *page) {
+	ASSERT (pg_ofs (page->va) == 0);
+	return radix_insert (&spt->pages, page->va, page);
+}
+
+/* PAGE의 frame을 정리하고 PAGE를 해제한다.  PAGE는 이미 SPT에서
+   빠져 있고 매핑도 지워져 있어야 한다.  매핑이 남아 있으면
+   pml4_destroy()가 frame이나 zero_page를 한 번 더 해제한다. */
+static void
+page_free (struct page *page) {
+	struct frame *frame;
+
+	/* 다른 page와 나눠 쓰는 frame이면 나만 빠진다.  마지막 page였다면
+	   policy에서 빼 두어 destroy 중에 빼앗기지 않게 한다. */
+	rwlock_acquire_read (&migrate_lock);
+	lock_acquire (&frame_lock);
+	frame = page->frame;
+	if (frame != NULL) {
+		frame_unlink (frame, page);
+		if (frame->page_cnt == 0)
+			policy->remove (frame);
+		else
+			frame = NULL;
+	}
+	lock_release (&frame_lock);
 
-	return succ;
+	vm_dealloc_page (page);
+	if (frame != NULL)
+		frame_free (frame);
+	rwlock_release_read (&migrate_lock);
 }
 
-void
+/* Removes PAGE from SPT and frees it.  Returns false, leaving
+   PAGE in place, if PAGE lies in a huge page that cannot be split
+   for lack of memory. */
+bool
 spt_remove_page (struct supplemental_page_table *spt, struct page *page) {
-	vm_dealloc_page (page);
+	bool success = true;
+
+	/* 다른 스레드의 eviction과 겹치지 않게 frame_lock을 쥐고 지운다. */
+	rwlock_acquire_read (&migrate_lock);
+	lock_acquire (&frame_lock);
+	if (page->pml4 != NULL)
+		success = pml4_clear_page (page->pml4, page->va);
+	lock_release (&frame_lock);
+	rwlock_release_read (&migrate_lock);
+	if (!success)
+		return false;
+
+	radix_remove (&spt->pages, page->va);
+	page_free (page);
 	return true;
 }
 
@@ -90,6 +287,8 @@ static struct frame *
 vm_get_victim (void) {
 	struct frame *victim = NULL;
 	 /* TODO: The policy for eviction is up to you. */
+	ASSERT (lock_held_by_current_thread (&frame_lock));
+	victim = policy->victim ();
 
 	return victim;
 }
@@ -97,11 +296,87 @@ vm_get_victim (void) {
 /* Evict one page and return the corresponding frame.
  * Return NULL on error.*/
 static struct frame *
-vm_evict_frame (void) {
-	struct frame *victim UNUSED = vm_get_victim ();
+vm_evict_frame (struct tlb_batch *batch) {
+	struct frame *victim = vm_get_victim ();
 	/* TODO: swap out the victim and return the evicted frame. */
+	struct list_elem *e;
+
+	if (victim == NULL)
+		return NULL;
+
+	/* huge page 안의 frame이면 먼저 나눈다.  page table을 받지 못하면
+	   내보내지 않고 policy에 돌려놓는다. */
+	for (e = list_begin (&victim->pages); e != list_end (&victim->pages);
+	     e = list_next (e)) {
+		struct page *page = list_entry (e, struct page, frame_elem);
+		if (!pml4_split_huge_page (page->pml4, page->va)) {
+			policy->add (victim);
+			return NULL;
+		}
+	}
+
+	/* 매핑을 먼저 모두 끊어야 내보내는 동안 내용이 바뀌지 않는다.
+	   TLB는 BATCH에 모아 두므로 tlb_batch_flush() 뒤에
+	   frame_swap_out()으로 내보낸다. */
+	for (e = list_begin (&victim->pages); e != list_end (&victim->pages);
+	     e = list_next (e)) {
+		struct page *page = list_entry (e, struct page, frame_elem);
+		pml4_clear_page_batch (batch, page->pml4, page->va);
+	}
+	return victim;
+}
+
+/* 매핑이 끊긴 FRAME의 page들을 swap으로 보낸다.  나눠 쓰던 page들은
+   swap slot 하나를 함께 쓴다. */
+static void
+frame_swap_out (struct frame *frame) {
+	while (!list_empty (&frame->pages)) {
+		struct page *page = list_entry (list_front (&frame->pages),
+		                                struct page, frame_elem);
+		if (!swap_out (page))
+			PANIC ("vm_evict_frame: cannot swap out page %p", page->va);
+		frame_unlink (frame, page);
+	}
+	evict_cnt++;
+}
 
-	return NULL;
+/* Evicts up to SWAP_CLUSTER pages into one run of swap slots and
+   hands them to swapd.  The mappings of all the victims are
+   removed first, with one batched TLB flush, so that none of
+   them can change while it is written out.  Returns false if
+   nothing was evicted. */
+static bool
+vm_reclaim (void) {
+	struct frame *victims[SWAP_CLUSTER];
+	size_t cnt = swap_batch_begin (SWAP_CLUSTER);
+	size_t evicted = 0;
+	struct tlb_batch batch;
+
+	ASSERT (lock_held_by_current_thread (&frame_lock));
+	tlb_batch_init (&batch, NULL);
+	while (evicted < cnt) {
+		struct frame *frame = vm_evict_frame (&batch);
+
+		if (frame == NULL)
+			break;
+		victims[evicted++] = frame;
+	}
+	tlb_batch_flush (&batch);
+
+	for (size_t i = 0; i < evicted; i++) {
+		struct frame *frame = victims[i];
+
+		frame_swap_out (frame);
+		if (frame->writeback)
+			writeback_cnt++;
+		else {
+			list_push_back (&free_frames, &frame->elem);
+			free_cnt++;
+		}
+	}
+	if (cnt > 0)
+		swap_batch_submit ();
+	return evicted > 0;
 }
 
 /* palloc() and get frame. If there is no available page, evict the page
@@ -112,20 +387,400 @@ static struct frame *
 vm_get_frame (void) {
 	struct frame *frame = NULL;
 	/* TODO: Fill this function. */
+	bool dry = true;
+	bool waited = false;
+
+	ASSERT (lock_held_by_current_thread (&frame_lock));
+	for (;;) {
+		void *kva;
+
+		if (!list_empty (&free_frames)) {
+			frame = list_entry (list_pop_front (&free_frames),
+			                    struct frame, elem);
+			free_cnt--;
+			memset (frame->kva, 0, PGSIZE);
+			break;
+		}
+		kva = palloc_get_page (PAL_USER | PAL_ZERO);
+		if (kva != NULL) {
+			frame = kmem_cache_alloc (frame_cache);
+			if (frame == NULL)
+				PANIC ("vm_get_frame: out of memory");
+			frame->kva = kva;
+			frame->writeback = false;
+			frame_cnt++;
+			dry = false;
+			pool_dry = false;
+			break;
+		}
+
+		pool_dry = true;
+
+		/* 쓰는 중인 묶음이 없을 때만 새로 내보낸다.  있으면 그것이
+		   끝나기를 기다리는 편이 덜 내보낸다. */
+		if (writeback_cnt == 0 && !vm_reclaim ())
+			PANIC ("vm_get_frame: out of frames and swap slots");
+		if (list_empty (&free_frames)) {
+			if (!waited)
+				wait_cnt++;
+			waited = true;
+			cond_wait (&frame_freed, &frame_lock);
+		}
+	}
+
+	/* pool이 바닥났으니 다음 fault를 위해 미리 내보내 둔다. */
+	if (dry && free_cnt + writeback_cnt < FRAME_RESERVE)
+		vm_reclaim ();
 
 	ASSERT (frame != NULL);
 	ASSERT (frame->page == NULL);
+	ASSERT (frame->page_cnt == 0 && frame->pinned == 0);
 	return frame;
 }
 
+/* frame_cache의 constructor.  아무 page도 쓰지 않는 frame으로 만든다.
+   마지막 page가 빠지면 frame은 다시 이 상태가 되므로 free_frames에
+   넣거나 cache로 돌려보낼 때 따로 초기화하지 않는다. */
+static void
+frame_ctor (void *obj) {
+	struct frame *frame = obj;
+
+	frame->page = NULL;
+	list_init (&frame->pages);
+	frame->page_cnt = 0;
+	frame->pinned = 0;
+}
+
+/* Returns FRAME, which is not in the policy, to the user pool. */
+static void
+frame_free (struct frame *frame) {
+	palloc_free_page (frame->kva);
+	kmem_cache_free (frame_cache, frame);
+	lock_acquire (&frame_lock);
+	frame_cnt--;
+	/* frame을 기다리는 스레드는 pool에서 다시 받아 갈 수 있다. */
+	cond_broadcast (&frame_freed, &frame_lock);
+	lock_release (&frame_lock);
+}
+
+/* PAGE가 FRAME을 쓰게 한다. */
+static void
+frame_link (struct frame *frame, struct page *page) {
+	ASSERT (lock_held_by_current_thread (&frame_lock));
+	list_push_back (&frame->pages, &page->frame_elem);
+	frame->page_cnt++;
+	frame->page = list_entry (list_front (&frame->pages), struct page,
+	                          frame_elem);
+	page->frame = frame;
+}
+
+/* PAGE가 더는 FRAME을 쓰지 않는다. */
+static void
+frame_unlink (struct frame *frame, struct page *page) {
+	ASSERT (lock_held_by_current_thread (&frame_lock));
+	ASSERT (page->frame == frame);
+	list_remove (&page->frame_elem);
+	frame->page_cnt--;
+	frame->page = list_empty (&frame->pages) ? NULL
+		: list_entry (list_front (&frame->pages), struct page, frame_elem);
+	page->frame = NULL;
+}
+
+/* Tests and clears the accessed bits of every mapping of FRAME.
+   Returns true if any was set.  For a page in a huge page, this
+   is the bit of the whole huge page. */
+bool
+vm_frame_accessed (struct frame *frame) {
+	bool accessed = false;
+	struct list_elem *e;
+
+	for (e = list_begin (&frame->pages); e != list_end (&frame->pages);
+	     e = list_next (e)) {
+		struct page *page = list_entry (e, struct page, frame_elem);
+
+		if (pml4_is_accessed (page->pml4, page->va)) {
+			pml4_set_accessed (page->pml4, page->va, false);
+			accessed = true;
+		}
+	}
+	return accessed;
+}
+
 /* Growing the stack. */
 static void
 vm_stack_growth (void *addr UNUSED) {
 }
 
+/* PAGE에 아직 아무것도 쓰이지 않아 내용이 모두 0이면 true.
+   초기화 함수 없이 만든 anon page이거나, 올라오지 않았고 swap에도
+   없는 anon page다. */
+static bool
+page_is_zero (struct page *page) {
+	if (VM_TYPE (page->operations->type) == VM_UNINIT)
+		return VM_TYPE (page->uninit.type) == VM_ANON
+			&& page->uninit.init == NULL;
+	return anon_is_zero (page);
+}
+
+/* Maps zero_page read-only at PAGE, which must satisfy
+   page_is_zero(). */
+static bool
+map_zero_page (struct page *page, uint64_t *pml4) {
+	bool success = true;
+
+	/* 다른 스레드의 eviction이 같은 page table을 비우고 해제할 수
+	   있으므로 PTE는 frame_lock을 쥐고 바꾼다. */
+	rwlock_acquire_read (&migrate_lock);
+	lock_acquire (&frame_lock);
+	if (page->frame != NULL)
+		/* 그 사이 다른 경로에서 이미 올렸다. */
+		goto done;
+
+	/* uninit이면 anon으로 바꾼다.  초기화 함수가 없으므로 zero_page에는
+	   아무것도 쓰지 않는다. */
+	success = (VM_TYPE (page->operations->type) != VM_UNINIT
+	           || swap_in (page, zero_page))
+	          && pml4_set_page (pml4, page->va, zero_page, false);
+	if (success) {
+		page->pml4 = pml4;
+		zero_cnt++;
+	}
+done:
+	lock_release (&frame_lock);
+	rwlock_release_read (&migrate_lock);
+	return success;
+}
+
+/* PAGE가 아직 올라오지 않았고 초기화 함수로 내용을 채우는 page,
+   즉 ELF segment처럼 파일에서 읽어 오는 page이면 true. */
+static bool
+page_is_lazy (struct page *page) {
+	return VM_TYPE (page->operations->type) == VM_UNINIT
+		&& page->uninit.init != NULL;
+}
+
+/* Returns the stream of SPT that a fault at VA continues, or sets
+   up a new one for it.  Adapts the stream's window: a fault just
+   past the previous window doubles it, any other fault in a new
+   stream starts from half the window of the stream it replaces. */
+static struct fault_stream *
+stream_get (struct supplemental_page_table *spt, void *va) {
+	struct fault_stream *s;
+
+	for (size_t i = 0; i < FAULT_STREAMS; i++) {
+		s = &spt->streams[i];
+		if (s->next == va) {
+			if (s->window < FAULT_AROUND_MAX)
+				s->window *= 2;
+			return s;
+		}
+	}
+
+	/* 이어지는 흐름이 없다.  무작위 접근이 계속되면 window가 줄어든다. */
+	s = &spt->streams[spt->stream_victim];
+	spt->stream_victim = (spt->stream_victim + 1) % FAULT_STREAMS;
+	if (s->next != NULL && s->window > 1)
+		s->window /= 2;
+	return s;
+}
+
+/* Claims PAGE, a lazy page, and the lazy pages around it in the
+   same window-aligned block of virtual pages.  The file contents
+   of the window are read ahead first, one read per stretch that
+   is contiguous in the file.  Neighbors that were never touched
+   and hold only zeros get zero_page instead.  Neighbors are
+   skipped while user memory is short. */
+static bool
+fault_around (struct supplemental_page_table *spt, struct page *page) {
+	struct fault_stream *s = stream_get (spt, page->va);
+	uint8_t *start = (uint8_t *) ((uint64_t) page->va
+	                              & ~(s->window * PGSIZE - 1));
+	uint8_t *end = start + s->window * PGSIZE;
+	struct page *pages[FAULT_AROUND_MAX];
+	size_t cnt = 0, mapped = 0;
+	uint8_t *buf = NULL;
+	bool success;
+
+	/* window 안에서 올릴 page를 주소 순서로 모은다.  PAGE도 들어간다. */
+	for (uint8_t *va = start; va < end && !pool_dry; va += PGSIZE) {
+		struct page *n = spt_find_page (spt, va);
+
+		if (n != NULL && (page_is_lazy (n)
+		                  || (VM_TYPE (n->operations->type) == VM_UNINIT
+		                      && page_is_zero (n))))
+			pages[cnt++] = n;
+	}
+
+	if (cnt > 1 && (buf = vmalloc (cnt * PGSIZE)) != NULL)
+		ahead_pages += segment_read_ahead (pages, cnt, buf);
+
+	success = vm_do_claim_page (page);
+	for (size_t i = 0; success && i < cnt && !pool_dry; i++) {
+		struct page *n = pages[i];
+
+		if (n == page)
+			continue;
+		if (page_is_lazy (n) ? !vm_do_claim_page (n)
+		                     : !map_zero_page (n, thread_current ()->pml4))
+			break;
+		mapped++;
+	}
+
+	if (buf != NULL) {
+		segment_read_ahead_end (pages, cnt);
+		vfree (buf);
+	}
+	if (!success)
+		return false;
+	s->next = end;
+	if (mapped > 0) {
+		around_cnt++;
+		around_pages += mapped;
+	}
+	return true;
+}
+
+/* PAGE를 WRITABLE 권한의 huge page에 넣을 수 있으면 true.  아직
+   올라온 적 없는 anon page만 된다.  uninit page는 zero_page가 매핑된
+   적도 없다. */
+static bool
+page_is_huge_candidate (struct page *page, bool writable) {
+	return page != NULL && page->frame == NULL
+		&& VM_TYPE (page->operations->type) == VM_UNINIT
+		&& VM_TYPE (page->uninit.type) == VM_ANON
+		&& page->writable == writable;
+}
+
+/* Claims the 2 MB aligned block of virtual pages around PAGE as
+   one huge page, if every page in it is a huge page candidate
+   and 2 MB of contiguous user memory is free.  If the block
+   cannot be mapped as a whole, the pages that were filled are
+   mapped one by one instead; a filled page that cannot be mapped
+   keeps its frame and is mapped by claim_page_in() on its next
+   fault.  Returns true if PAGE got a frame, otherwise the caller
+   claims PAGE alone. */
+static bool
+claim_huge (struct supplemental_page_table *spt, struct page *page) {
+	uint8_t *base = (uint8_t *) ((uint64_t) page->va & ~(HPGSIZE - 1));
+	uint64_t *pml4 = thread_current ()->pml4;
+	size_t filled, i;
+	uint8_t *kva;
+	bool huge, success;
+
+	if (pool_dry || !page_is_huge_candidate (page, page->writable))
+		return false;
+	for (i = 0; i < HPG_PAGES; i++)
+		if (!page_is_huge_candidate (spt_find_page (spt, base + i * PGSIZE),
+		                             page->writable))
+			return false;
+
+	rwlock_acquire_read (&migrate_lock);
+	kva = palloc_get_huge_page (PAL_USER | PAL_ZERO);
+	if (kva == NULL) {
+		rwlock_release_read (&migrate_lock);
+		return false;
+	}
+
+	/* 4 kB마다 frame을 하나씩 만들어 page에 잇는다. */
+	lock_acquire (&frame_lock);
+	for (i = 0; i < HPG_PAGES; i++) {
+		struct page *p = spt_find_page (spt, base + i * PGSIZE);
+		struct frame *frame = kmem_cache_alloc (frame_cache);
+
+		if (frame == NULL)
+			PANIC ("claim_huge: out of memory");
+		frame->kva = kva + i * PGSIZE;
+		frame->writeback = false;
+		frame->pinned++;
+		frame_link (frame, p);
+		p->pml4 = pml4;
+	}
+	frame_cnt += HPG_PAGES;
+	lock_release (&frame_lock);
+
+	/* claim_page_in()처럼 내용을 채우는 동안은 frame_lock을 놓는다.
+	   실패하면 그 뒤의 page는 uninit으로 남겨 나중에 따로 올린다. */
+	for (filled = 0; filled < HPG_PAGES; filled++) {
+		struct page *p = spt_find_page (spt, base + filled * PGSIZE);
+		if (!swap_in (p, p->frame->kva))
+			break;
+	}
+
+	lock_acquire (&frame_lock);
+	huge = filled == HPG_PAGES
+	       && pml4_set_huge_page (pml4, base, kva, page->writable);
+	for (i = 0; i < HPG_PAGES; i++) {
+		struct page *p = spt_find_page (spt, base + i * PGSIZE);
+		struct frame *frame = p->frame;
+
+		frame->pinned--;
+		if (huge || i < filled) {
+			/* 이미 anon이 되어 내용이 frame에만 있으므로 매핑하지 못해도
+			   frame은 남긴다. */
+			if (!huge)
+				pml4_set_page (pml4, p->va, frame->kva, p->writable);
+			policy->add (frame);
+		} else {
+			frame_unlink (frame, p);
+			palloc_free_page (frame->kva);
+			kmem_cache_free (frame_cache, frame);
+			frame_cnt--;
+		}
+	}
+	if (huge)
+		huge_cnt++;
+	else
+		cond_broadcast (&frame_freed, &frame_lock);
+	success = page->frame != NULL;
+	lock_release (&frame_lock);
+	rwlock_release_read (&migrate_lock);
+	return success;
+}
+
 /* Handle the fault on write_protected page */
 static bool
-vm_handle_wp (struct page *page UNUSED) {
+vm_handle_wp (struct page *page) {
+	struct frame *old, *new;
+
+	rwlock_acquire_read (&migrate_lock);
+	lock_acquire (&frame_lock);
+	if (page->frame == NULL && page->pml4 != NULL
+			&& pml4_get_page (page->pml4, page->va) == zero_page) {
+		/* zero_page에 처음 쓴다.  매핑을 끊고 자기 frame을 받는다. */
+		pml4_clear_page (page->pml4, page->va);
+		lock_release (&frame_lock);
+		rwlock_release_read (&migrate_lock);
+		return vm_do_claim_page (page);
+	}
+	old = page->frame;
+	/* huge page의 한 page만 다시 매핑하거나 쓰기를 허락할 수는 없다. */
+	if (old != NULL && !pml4_split_huge_page (page->pml4, page->va)) {
+		lock_release (&frame_lock);
+		rwlock_release_read (&migrate_lock);
+		return false;
+	}
+	if (old != NULL && old->page_cnt > 1) {
+		/* fork 뒤 처음 쓰는 page다.  내 frame을 받아 복사한다.
+		   frame을 기다리는 동안 old가 내보내지지 않게 고정한다. */
+		old->pinned++;
+		new = vm_get_frame ();
+		old->pinned--;
+		memcpy (new->kva, old->kva, PGSIZE);
+		frame_unlink (old, page);
+		frame_link (new, page);
+		if (!pml4_remap_page (page->pml4, page->va, new->kva))
+			NOT_REACHED ();
+		policy->add (new);
+		cow_cnt++;
+	}
+	/* 혼자 쓰는 frame이면 쓰기만 허락하면 된다.  그 사이 내보내졌으면
+	   (old == NULL) 다시 fault가 나서 새로 올라온다. */
+	if (page->frame != NULL
+			&& !pml4_protect_range (page->pml4, page->va, 1, true))
+		NOT_REACHED ();
+	lock_release (&frame_lock);
+	rwlock_release_read (&migrate_lock);
+	return true;
 }
 
 /* Return true on success */
@@ -136,6 +791,20 @@ vm_try_handle_fault (struct intr_frame *f UNUSED, void *addr UNUSED,
 	struct page *page = NULL;
 	/* TODO: Validate the fault */
 	/* TODO: Your code goes here */
+	if (addr == NULL || !is_user_vaddr (addr))
+		return false;
+	page = spt_find_page (spt, addr);
+	if (page == NULL || (write && !page->writable))
+		return false;
+	if (!not_present)
+		return write && vm_handle_wp (page);
+	/* 읽기만 하면 zero_page로 충분하다.  huge page는 쓸 때 만든다. */
+	if (!write && page_is_zero (page))
+		return map_zero_page (page, thread_current ()->pml4);
+	if (claim_huge (spt, page))
+		return true;
+	if (page_is_lazy (page))
+		return fault_around (spt, page);
 
 	return vm_do_claim_page (page);
 }
@@ -150,9 +819,12 @@ vm_dealloc_page (struct page *page) {
 
 /* Claim the page that allocate on VA. */
 bool
-vm_claim_page (void *va UNUSED) {
+vm_claim_page (void *va) {
 	struct page *page = NULL;
 	/* TODO: Fill this function */
+	page = spt_find_page (&thread_current ()->spt, va);
+	if (page == NULL)
+		return false;
 
 	return vm_do_claim_page (page);
 }
@@ -160,31 +832,182 @@ vm_claim_page (void *va UNUSED) {
 /* Claim the PAGE and set up the mmu. */
 static bool
 vm_do_claim_page (struct page *page) {
-	struct frame *frame = vm_get_frame ();
+	return claim_page_in (page, thread_current ()->pml4);
+}
+
+/* PAGE에 frame을 주고 PML4에 매핑한다.  fork 중에는 부모의 page를
+   부모의 PML4에 올릴 때도 쓴다. */
+static bool
+claim_page_in (struct page *page, uint64_t *pml4) {
+	struct frame *frame;
+	bool success = false;
+
+	rwlock_acquire_read (&migrate_lock);
+	lock_acquire (&frame_lock);
+	if (page->frame != NULL) {
+		/* 그 사이 다른 경로에서 이미 올렸다.  claim_huge()가 매핑하지
+		   못하고 남긴 frame이면 여기서 매핑한다. */
+		success = pml4_get_page (pml4, page->va) != NULL
+		          || pml4_set_page (pml4, page->va, page->frame->kva,
+		                            page->writable);
+		goto done;
+	}
+	frame = vm_get_frame ();
+	if (page->frame != NULL) {
+		/* frame을 기다리는 사이 다른 경로에서 올렸다. */
+		list_push_back (&free_frames, &frame->elem);
+		free_cnt++;
+		success = true;
+		goto done;
+	}
 
 	/* Set links */
-	frame->page = page;
-	page->frame = frame;
+	frame_link (frame, page);
+	page->pml4 = pml4;
+
+	/* 내용을 채우는 동안은 frame_lock을 놓는다.  frame은 아직 policy에
+	   없고 고정해 두었으므로 내보내지지 않는다.  내용을 채운 뒤에
+	   매핑해야 다른 스레드가 빈 page를 보지 않는다. */
+	frame->pinned++;
+	lock_release (&frame_lock);
+	success = swap_in (page, frame->kva);
+	lock_acquire (&frame_lock);
+	frame->pinned--;
 
 	/* TODO: Insert page table entry to map page's VA to frame's PA. */
-
-	return swap_in (page, frame->kva);
+	if (!success
+			|| !pml4_set_page (pml4, page->va, frame->kva, page->writable)) {
+		frame_unlink (frame, page);
+		lock_release (&frame_lock);
+		frame_free (frame);
+		rwlock_release_read (&migrate_lock);
+		return false;
+	}
+	policy->add (frame);
+	success = true;
+done:
+	lock_release (&frame_lock);
+	rwlock_release_read (&migrate_lock);
+	return success;
 }
 
 /* Initialize new supplemental page table */
 void
-supplemental_page_table_init (struct supplemental_page_table *spt UNUSED) {
+supplemental_page_table_init (struct supplemental_page_table *spt) {
+	radix_init (&spt->pages);
+	for (size_t i = 0; i < FAULT_STREAMS; i++) {
+		spt->streams[i].next = NULL;
+		spt->streams[i].window = FAULT_AROUND;
+	}
+	spt->stream_victim = 0;
+}
+
+/* supplemental_page_table_copy()용 radix_for_each() 콜백.
+   자식(현재 스레드)에 같은 VA의 anon page를 만들어 부모 page의 frame을
+   copy-on-write로 나눠 쓴다.  둘 다 읽기 전용으로 매핑해 두고, 먼저
+   쓰는 쪽이 vm_handle_wp()에서 자기 frame으로 복사해 간다. */
+static bool
+copy_page (void *va, void *value, void *aux) {
+	struct thread *parent = aux;
+	struct page *src = value;
+	struct page *dst;
+	struct frame *frame;
+	uint64_t *pml4 = thread_current ()->pml4;
+	bool success;
+
+	if (!vm_alloc_page (VM_ANON, va, src->writable))
+		return false;
+	dst = spt_find_page (&thread_current ()->spt, va);
+
+	/* 내용이 모두 0인 page는 자식도 새 page로 충분하다.  부모에
+	   zero_page가 매핑되어 있다면 그대로 둔다. */
+	if (page_is_zero (src))
+		return true;
+
+	/* 부모가 아직 한 번도 건드리지 않았거나 내보낸 page는 부모 쪽에
+	   먼저 올려둔다.  부모는 fork가 끝날 때까지 기다리고 있다. */
+	for (;;) {
+		rwlock_acquire_read (&migrate_lock);
+		lock_acquire (&frame_lock);
+		if (src->frame != NULL)
+			break;
+		lock_release (&frame_lock);
+		rwlock_release_read (&migrate_lock);
+		if (!claim_page_in (src, parent->pml4))
+			return false;
+	}
+
+	/* dst를 anon page로 바꾼다.  초기화 함수가 없으므로 frame의 내용은
+	   그대로 남는다. */
+	frame = src->frame;
+	success = swap_in (dst, frame->kva)
+	          && pml4_set_page (pml4, va, frame->kva, false);
+	if (success) {
+		dst->pml4 = pml4;
+		frame_link (frame, dst);
+		if (src->writable
+				&& !pml4_protect_range (src->pml4, va, 1, false))
+			NOT_REACHED ();
+		share_cnt++;
+	}
+	lock_release (&frame_lock);
+	rwlock_release_read (&migrate_lock);
+	return success;
 }
 
 /* Copy supplemental page table from src to dst */
 bool
 supplemental_page_table_copy (struct supplemental_page_table *dst UNUSED,
-		struct supplemental_page_table *src UNUSED) {
+		struct supplemental_page_table *src) {
+	/* SPT는 부모의 struct thread 안에 있다. */
+	struct thread *parent = pg_round_down (src);
+
+	return radix_for_each (&src->pages, NULL, (void *) KERN_BASE,
+	                       copy_page, parent);
+}
+
+/* kill_page()가 매핑을 지워 온 범위. */
+struct kill_aux {
+	uint64_t *pml4;             /* Page map, or null if none. */
+	uint8_t *end;               /* Mappings below here are gone. */
+};
+
+/* supplemental_page_table_kill()용 radix_destroy() 콜백.  page가
+   있는 2 MB마다 매핑을 한 번에 지운다.  통째로 지우므로 huge page는
+   나누지 않고 PDE만 없앤다. */
+static bool
+kill_page (void *va, void *value, void *aux) {
+	struct kill_aux *k = aux;
+
+	if (k->pml4 != NULL && (uint8_t *) va >= k->end) {
+		uint8_t *base = (uint8_t *) ((uint64_t) va & ~(HPGSIZE - 1));
+
+		rwlock_acquire_read (&migrate_lock);
+		lock_acquire (&frame_lock);
+		if (!pml4_unmap_range (k->pml4, base, HPG_PAGES))
+			NOT_REACHED ();
+		lock_release (&frame_lock);
+		rwlock_release_read (&migrate_lock);
+		k->end = base + HPGSIZE;
+	}
+	page_free (value);
+	return true;
 }
 
 /* Free the resource hold by the supplemental page table */
 void
-supplemental_page_table_kill (struct supplemental_page_table *spt UNUSED) {
+supplemental_page_table_kill (struct supplemental_page_table *spt) {
 	/* TODO: Destroy all the supplemental_page_table hold by thread and
 	 * TODO: writeback all the modified contents to the storage. */
+	struct thread *t = pg_round_down (spt);
+	struct kill_aux k = { t->pml4, NULL };
+
+	radix_destroy (&spt->pages, kill_page, &k);
+
+	/* pml4 page는 곧 다른 프로세스가 다시 쓸 수 있다. */
+	if (policy->forget != NULL && t->pml4 != NULL) {
+		lock_acquire (&frame_lock);
+		policy->forget (t->pml4);
+		lock_release (&frame_lock);
+	}
 }